@@ -6,9 +6,25 @@ from ._sauerkraut import (
     resume_greenlet,
     copy_frame_from_greenlet,
     copy_current_frame,
+    compression_codecs,
+    serialize_frames,
+    deserialize_frames,
+    code_hash,
+    peek_frame,
+    stats,
+    set_code_registry,
+    set_frame_pool_limit,
+    set_weak_code_cache,
+    compile_exclusions,
+    CheckpointWriter,
 )
 
 from . import liveness
+from .frame_io import write_frame, read_frame, deserialize_frame_from_file
+from .registry import CodeRegistry
+from .snapshot import BackgroundSnapshot, SnapshotError
+from .archive import ArchiveWriter, ArchiveReader
+from .analysis import analyze_frame, FrameReport
 
 
 __all__ = [
@@ -19,5 +35,26 @@ __all__ = [
     "resume_greenlet",
     "copy_frame_from_greenlet",
     "copy_current_frame",
+    "compression_codecs",
+    "serialize_frames",
+    "deserialize_frames",
+    "code_hash",
+    "peek_frame",
+    "stats",
+    "set_code_registry",
+    "set_frame_pool_limit",
+    "set_weak_code_cache",
+    "compile_exclusions",
+    "CheckpointWriter",
+    "CodeRegistry",
+    "BackgroundSnapshot",
+    "SnapshotError",
+    "ArchiveWriter",
+    "ArchiveReader",
+    "analyze_frame",
+    "FrameReport",
     "liveness",
+    "write_frame",
+    "read_frame",
+    "deserialize_frame_from_file",
 ]
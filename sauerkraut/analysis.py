@@ -0,0 +1,111 @@
+"""What each part of a frame costs to serialize.
+
+``analyze_frame(frame)`` takes a serialized frame, and ``report=True`` on
+``copy_frame``, ``copy_frame_from_greenlet`` and ``copy_current_frame``
+makes them return ``(result, report)`` instead of ``result``.  Either way
+the report is a ``FrameReport`` with one ``ReportEntry`` per part of the
+frame:
+
+    section   "local", "cell" or "free" for each slot of localsplus,
+              "stack" for each value on the evaluation stack, "globals",
+              "code" and "module_source"
+    index     position of the slot or stack entry, 0 otherwise
+    name      the local's name, the code's qualified name or the module's
+    type      type name of the value, None for an unbound local
+    size      bytes the part takes when serialized on its own
+    time_ns   nanoseconds serializing it took
+    excluded  whether the frame leaves it out: excluded and dead locals,
+              globals under ``exclude_immutables`` and module source that
+              was not captured
+
+Sizes are measured by serializing every part on its own, so an object that
+several locals refer to counts towards each of them, while the frame itself
+stores it once.  Out-of-band data is counted in the size of its local.
+
+    _, report = sauerkraut.copy_frame_from_greenlet(gr, serialize=True, report=True)
+    print(report)
+    for entry in report.largest(3):
+        ...
+"""
+
+from typing import NamedTuple, Optional
+
+from ._sauerkraut import analyze_frame
+
+
+class ReportEntry(NamedTuple):
+    section: str
+    index: int
+    name: Optional[str]
+    type: Optional[str]
+    size: int
+    time_ns: int
+    excluded: bool
+
+
+class FrameReport:
+    def __init__(self, entries, frame_size=None):
+        """A report of ``entries`` (tuples in ``ReportEntry`` order).
+
+        ``frame_size`` is the size of the whole serialized frame, or None
+        when the frame was copied without being serialized.
+        """
+        self.entries = [ReportEntry(*entry) for entry in entries]
+        self.frame_size = frame_size
+
+    @property
+    def total(self):
+        """Bytes of every part that the frame keeps."""
+        return sum(entry.size for entry in self.entries if not entry.excluded)
+
+    def largest(self, n=10):
+        """The n biggest parts the frame keeps, biggest first."""
+        kept = [entry for entry in self.entries if not entry.excluded]
+        return sorted(kept, key=lambda entry: entry.size, reverse=True)[:n]
+
+    def by_section(self):
+        """{section: (size, time_ns)} summed over the parts the frame keeps."""
+        sections = {}
+        for entry in self.entries:
+            if entry.excluded:
+                continue
+            size, time_ns = sections.get(entry.section, (0, 0))
+            sections[entry.section] = (size + entry.size, time_ns + entry.time_ns)
+        return sections
+
+    def to_dict(self):
+        return {
+            "frame_size": self.frame_size,
+            "total": self.total,
+            "entries": [entry._asdict() for entry in self.entries],
+        }
+
+    def __iter__(self):
+        return iter(self.entries)
+
+    def __len__(self):
+        return len(self.entries)
+
+    def __repr__(self):
+        return f"<FrameReport: {len(self.entries)} entries, {self.total} bytes>"
+
+    def __str__(self):
+        rows = [("section", "index", "name", "type", "bytes", "us", "")]
+        for entry in self.entries:
+            rows.append((
+                entry.section,
+                str(entry.index),
+                entry.name or "",
+                entry.type or "",
+                str(entry.size),
+                f"{entry.time_ns / 1e3:.1f}",
+                "excluded" if entry.excluded else "",
+            ))
+        widths = [max(len(row[i]) for row in rows) for i in range(len(rows[0]))]
+        lines = ["  ".join(cell.ljust(width) for cell, width in zip(row, widths)).rstrip() for row in rows]
+        summary = f"total {self.total} bytes"
+        if self.frame_size is not None:
+            summary += f", frame {self.frame_size} bytes"
+        lines.append(summary)
+        return "\n".join(lines)
+
@@ -0,0 +1,342 @@
+"""An append-only archive of serialized frames with a trailing index.
+
+Keeping one file per frame and generation puts a file system entry behind
+every checkpoint.  An archive holds any number of them in one file:
+
+    header | record | record | ... | index | footer
+
+The header (``_HEADER``) is the archive magic and the alignment the
+archive was created with.  Each record is a record header (``_RECORD``:
+record magic, key length, generation, frame size, CRC-32 of the frame),
+the key, padding to the alignment and the frame.  The index starts with
+its own magic and lists every record as (key, generation, offset, size,
+checksum); the footer points at it.  ``ArchiveWriter`` appends records and
+rewrites the index on ``close``; reopening an archive appends after the
+last record.  If a writer dies before writing the index, the index is
+rebuilt by walking the records.  A damaged record that runs to the end of
+the file is a torn append and is dropped; one followed by more data is
+corruption and raises ``ValueError``, so no later record is lost.
+
+``ArchiveReader`` maps the file once and returns frames as slices of the
+mapping, which ``deserialize_frame`` reads without copying:
+
+    with ArchiveWriter("run.skar") as archive:
+        archive.append("worker-3", sauerkraut.copy_frame_from_greenlet(gr, serialize=True))
+
+    reader = ArchiveReader("run.skar")
+    frame = sauerkraut.deserialize_frame(reader.latest("worker-3"))
+"""
+
+import errno
+import mmap
+import os
+import struct
+import zlib
+
+from ._sauerkraut import deserialize_frame
+
+MAGIC = b"SKARCH02"
+DEFAULT_ALIGNMENT = 64
+
+_HEADER = struct.Struct("<8sI4x")
+_RECORD_MAGIC = b"SKRC"
+_RECORD = struct.Struct("<4sIQQI")
+_INDEX_MAGIC = b"SKIX"
+_INDEX_ENTRY = struct.Struct("<IQQQI")
+_FOOTER = struct.Struct("<QQ8s")
+_FOOTER_MAGIC = b"SKARIDX1"
+
+
+def _padding(offset, alignment):
+    return -offset % alignment
+
+
+def _encode_key(key):
+    if not isinstance(key, str):
+        raise TypeError("archive keys must be strings")
+    return key.encode("utf-8")
+
+
+def _decode_key(raw):
+    return bytes(raw).decode("utf-8")
+
+
+class _Entry:
+    __slots__ = ("generation", "offset", "size", "checksum")
+
+    def __init__(self, generation, offset, size, checksum):
+        self.generation = generation
+        self.offset = offset
+        self.size = size
+        self.checksum = checksum
+
+
+def _read_header(view, path):
+    """The alignment the archive at ``path`` was created with."""
+    if len(view) < _HEADER.size:
+        raise ValueError(f"{path} is not a sauerkraut archive")
+    magic, alignment = _HEADER.unpack_from(view, 0)
+    if magic != MAGIC:
+        raise ValueError(f"{path} is not a sauerkraut archive")
+    if alignment <= 0 or alignment & (alignment - 1):
+        raise ValueError(f"{path} has an invalid alignment of {alignment}")
+    return alignment
+
+
+def _read_index(view):
+    """The archive's index as {key: [entries by generation]}, or None if
+    the archive has no valid footer."""
+    if len(view) < _HEADER.size + len(_INDEX_MAGIC) + _FOOTER.size:
+        return None
+    index_offset, n_entries, magic = _FOOTER.unpack_from(view, len(view) - _FOOTER.size)
+    if magic != _FOOTER_MAGIC or index_offset > len(view) - _FOOTER.size - len(_INDEX_MAGIC):
+        return None
+    if view[index_offset : index_offset + len(_INDEX_MAGIC)] != _INDEX_MAGIC:
+        return None
+    index = {}
+    offset = index_offset + len(_INDEX_MAGIC)
+    try:
+        for _ in range(n_entries):
+            key_len, generation, record_offset, size, checksum = _INDEX_ENTRY.unpack_from(view, offset)
+            offset += _INDEX_ENTRY.size
+            key = _decode_key(view[offset : offset + key_len])
+            offset += key_len
+            if record_offset + size > index_offset:
+                return None
+            index.setdefault(key, []).append(_Entry(generation, record_offset, size, checksum))
+    except (struct.error, UnicodeDecodeError):
+        return None
+    return index, index_offset
+
+
+def _scan_records(view, alignment, path):
+    """Rebuild the index by walking the records.  Returns the index and
+    where the records end: at a stale index, or at a torn record that runs
+    to the end of the file.  Raises ValueError at a damaged record that
+    more data follows."""
+    index = {}
+    offset = _HEADER.size
+    while offset < len(view):
+        if offset + _RECORD.size > len(view):
+            break
+        magic, key_len, generation, size, checksum = _RECORD.unpack_from(view, offset)
+        if magic == _INDEX_MAGIC:
+            break
+        if magic != _RECORD_MAGIC:
+            # Space the file system extended but never wrote reads as zeros.
+            if not any(view[offset:]):
+                break
+            raise ValueError(f"{path}: corrupt record at offset {offset}")
+        key_start = offset + _RECORD.size
+        frame_offset = key_start + key_len
+        frame_offset += _padding(frame_offset, alignment)
+        end = frame_offset + size
+        if end > len(view):
+            break
+        next_offset = end + _padding(end, alignment)
+        try:
+            if zlib.crc32(view[frame_offset:end]) != checksum:
+                raise ValueError
+            key = _decode_key(view[key_start : key_start + key_len])
+        except ValueError:
+            if next_offset >= len(view):
+                break
+            raise ValueError(f"{path}: corrupt record at offset {offset}") from None
+        index.setdefault(key, []).append(_Entry(generation, frame_offset, size, checksum))
+        offset = next_offset
+    return index, min(offset, len(view))
+
+
+def _open_index(view, path):
+    """The index of the archive in ``view`` and where its records end."""
+    alignment = _read_header(view, path)
+    found = _read_index(view)
+    if found is None:
+        found = _scan_records(view, alignment, path)
+    return alignment, found
+
+
+class ArchiveWriter:
+    def __init__(self, path, alignment=None, sync=False):
+        """Open the archive at ``path`` for appending, creating it if needed.
+
+        Args:
+            path: The archive file.
+            alignment: Frames start on a multiple of this many bytes; must
+                be a power of two.  A new archive uses DEFAULT_ALIGNMENT if
+                this is None; an existing one keeps the alignment stored in
+                it, and a different value raises ValueError.
+            sync: fsync the file after each append and on close.
+        """
+        if alignment is not None and (alignment <= 0 or alignment & (alignment - 1)):
+            raise ValueError("alignment must be a power of two")
+        self.path = os.fspath(path)
+        self.sync = sync
+        self._fd = os.open(self.path, os.O_RDWR | os.O_CREAT, 0o644)
+        try:
+            self.alignment, self._index, self._end = self._load(alignment)
+        except BaseException:
+            os.close(self._fd)
+            raise
+        self._zeros = bytes(self.alignment)
+
+    def _load(self, alignment):
+        size = os.fstat(self._fd).st_size
+        if size == 0:
+            if alignment is None:
+                alignment = DEFAULT_ALIGNMENT
+            _pwritev_all(self._fd, [_HEADER.pack(MAGIC, alignment)], 0)
+            return alignment, {}, _HEADER.size
+        with mmap.mmap(self._fd, 0, access=mmap.ACCESS_READ) as mapped:
+            view = memoryview(mapped)
+            try:
+                stored, (index, end) = _open_index(view, self.path)
+            finally:
+                view.release()
+        if alignment is not None and alignment != stored:
+            raise ValueError(f"{self.path} was created with alignment {stored}, not {alignment}")
+        # Drop the old index (or a torn record); close writes a new index.
+        os.ftruncate(self._fd, end)
+        return stored, index, end
+
+    def append(self, key, frame):
+        """Append ``frame`` as the next generation of ``key``.
+
+        Returns the generation, counting from 0 for each key.
+        """
+        if self._fd is None:
+            raise ValueError("archive is closed")
+        raw_key = _encode_key(key)
+        frame = memoryview(frame).cast("B")
+        entries = self._index.setdefault(_decode_key(raw_key), [])
+        generation = entries[-1].generation + 1 if entries else 0
+        checksum = zlib.crc32(frame)
+
+        header = _RECORD.pack(_RECORD_MAGIC, len(raw_key), generation, len(frame), checksum) + raw_key
+        views = [header]
+        offset = self._end + len(header)
+        pad = _padding(offset, self.alignment)
+        if pad:
+            views.append(memoryview(self._zeros)[:pad])
+        frame_offset = offset + pad
+        views.append(frame)
+        end = frame_offset + len(frame)
+        pad = _padding(end, self.alignment)
+        if pad:
+            views.append(memoryview(self._zeros)[:pad])
+
+        _pwritev_all(self._fd, views, self._end)
+        if self.sync:
+            os.fsync(self._fd)
+        entries.append(_Entry(generation, frame_offset, len(frame), checksum))
+        self._end = end + pad
+        return generation
+
+    def close(self):
+        """Write the index and close the archive."""
+        if self._fd is None:
+            return
+        index = bytearray(_INDEX_MAGIC)
+        n_entries = 0
+        for key, entries in self._index.items():
+            raw_key = _encode_key(key)
+            for entry in entries:
+                index += _INDEX_ENTRY.pack(len(raw_key), entry.generation, entry.offset, entry.size, entry.checksum)
+                index += raw_key
+                n_entries += 1
+        index += _FOOTER.pack(self._end, n_entries, _FOOTER_MAGIC)
+        try:
+            _pwritev_all(self._fd, [memoryview(index)], self._end)
+            os.ftruncate(self._fd, self._end + len(index))
+            if self.sync:
+                os.fsync(self._fd)
+        finally:
+            os.close(self._fd)
+            self._fd = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+
+def _pwritev_all(fd, views, offset):
+    views = [view for view in (memoryview(v).cast("B") for v in views) if len(view)]
+    while views:
+        n = os.pwritev(fd, views, offset)
+        if n == 0:
+            raise OSError(errno.EIO, "pwritev wrote nothing")
+        offset += n
+        while views and n >= len(views[0]):
+            n -= len(views[0])
+            views.pop(0)
+        if n:
+            views[0] = views[0][n:]
+
+
+class ArchiveReader:
+    def __init__(self, path, verify=True):
+        """Map the archive at ``path``.
+
+        Args:
+            path: The archive file.
+            verify: Check each frame's CRC-32 before returning it.
+        """
+        self.path = os.fspath(path)
+        self.verify = verify
+        with open(self.path, "rb") as f:
+            self._mmap = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        self._view = memoryview(self._mmap)
+        try:
+            self.alignment, (self._index, _) = _open_index(self._view, self.path)
+        except BaseException:
+            self.close()
+            raise
+
+    def keys(self):
+        return list(self._index)
+
+    def generations(self, key):
+        return [entry.generation for entry in self._entries(key)]
+
+    def latest(self, key):
+        """The newest frame of ``key``, as a slice of the mapping."""
+        return self._frame(self._entries(key)[-1])
+
+    def get(self, key, generation):
+        """Frame ``generation`` of ``key``, as a slice of the mapping."""
+        for entry in self._entries(key):
+            if entry.generation == generation:
+                return self._frame(entry)
+        raise KeyError((key, generation))
+
+    def deserialize(self, key, generation=None, **kwargs):
+        """Deserialize a frame of ``key``, the newest if ``generation`` is
+        None.  Keyword arguments are forwarded to ``deserialize_frame``."""
+        frame = self.latest(key) if generation is None else self.get(key, generation)
+        return deserialize_frame(frame, **kwargs)
+
+    def _entries(self, key):
+        entries = self._index.get(key)
+        if not entries:
+            raise KeyError(key)
+        return entries
+
+    def _frame(self, entry):
+        frame = self._view[entry.offset : entry.offset + entry.size]
+        if self.verify and zlib.crc32(frame) != entry.checksum:
+            raise ValueError(f"{self.path}: checksum mismatch at offset {entry.offset}")
+        return frame
+
+    def close(self):
+        """Unmap the archive.  Frames returned earlier must be released
+        first."""
+        self._view.release()
+        self._mmap.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
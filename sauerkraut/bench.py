@@ -0,0 +1,331 @@
+"""Latency benchmarks for copying, serializing, deserializing and running frames.
+
+Each case builds a function with a given number of locals of one kind
+(ints, small dicts or NumPy arrays) and a given number of values on its
+evaluation stack, suspends it, and times five operations on it:
+
+    copy            copy_current_frame() / copy_frame_from_greenlet()
+    serialize       serialize_frame() of that copy
+    copy_serialize  the copy call with serialize=True, which is where
+                    exclude_immutables applies
+    deserialize     deserialize_frame() of the serialized frame
+    run             run_frame() of the deserialized frame
+
+Copies use ``snapshot="deep"`` unless the case asks for ``"selective"``,
+which skips excluded locals while copying.
+
+With ``copy_current_frame`` the copy times include calling the function.
+Half of the locals are still used after the capture, so
+``exclude_dead_locals`` has something to drop.  By default every parameter
+is varied on its own around a baseline; ``--full`` runs every combination.
+Results go to stdout (or ``--output``) as JSON, with p50/p99/mean latency
+in nanoseconds, frames per second, bytes per frame and the Python version,
+so runs under 3.13 and 3.14 can be compared:
+
+    python -m sauerkraut.bench --output results-3.13.json
+
+Run ``python -m sauerkraut.bench`` to benchmark the installed sauerkraut.
+``--build-dir`` points the benchmarks at the ``_sauerkraut`` module of a
+CMake build tree instead; that needs this file to be run as a script, which
+is what ``cmake --build build --target bench`` does.
+"""
+
+import argparse
+import atexit
+import gc
+import glob
+import importlib
+import itertools
+import json
+import os
+import platform
+import shutil
+import statistics
+import sys
+import tempfile
+import time
+
+BASELINE = {
+    "capture": "current",
+    "snapshot": "deep",
+    "n_locals": 16,
+    "local_kind": "int",
+    "stack_depth": 0,
+    "exclude_dead_locals": True,
+    "exclude_immutables": False,
+    "capture_module_source": False,
+}
+
+SWEEP = {
+    "capture": ["current", "greenlet"],
+    "snapshot": ["deep", "selective"],
+    "n_locals": [1, 16, 128],
+    "local_kind": ["int", "dict", "ndarray_1k", "ndarray_1m"],
+    "stack_depth": [0, 8, 32],
+    "exclude_dead_locals": [True, False],
+    "exclude_immutables": [False, True],
+    "capture_module_source": [False, True],
+}
+
+OPERATIONS = ["copy", "serialize", "copy_serialize", "deserialize", "run"]
+# Operations that produce or consume a serialized frame, reported in MB/s too.
+SIZED_OPERATIONS = ("serialize", "copy_serialize", "deserialize")
+
+WORKLOAD_MODULE = "_sauerkraut_bench_workloads"
+
+
+def use_build_dir(build_dir):
+    """Import sauerkraut from this source tree and the extension in build_dir."""
+    if "sauerkraut" in sys.modules:
+        sys.exit("--build-dir needs bench.py to be run as a script, not with -m")
+    matches = glob.glob(os.path.join(build_dir, "_sauerkraut*.so"))
+    matches += glob.glob(os.path.join(build_dir, "_sauerkraut*.pyd"))
+    if not matches:
+        sys.exit(f"no _sauerkraut module in {build_dir}; build the sauerkraut target")
+    package_src = os.path.dirname(os.path.abspath(__file__))
+    # Running this file puts the package directory itself on the path.
+    if sys.path and os.path.abspath(sys.path[0]) == package_src:
+        del sys.path[0]
+    root = tempfile.mkdtemp(prefix="sauerkraut-bench-")
+    atexit.register(shutil.rmtree, root, ignore_errors=True)
+    package = os.path.join(root, "sauerkraut")
+    os.mkdir(package)
+    for path in glob.glob(os.path.join(package_src, "*.py")):
+        shutil.copy(path, package)
+    shutil.copy(matches[0], os.path.join(package, os.path.basename(matches[0])))
+    sys.path.insert(0, root)
+
+
+def make_local(kind, index):
+    import numpy as np
+
+    if kind == "int":
+        return index
+    if kind == "dict":
+        return {f"key{i}": i + index for i in range(64)}
+    if kind == "ndarray_1k":
+        return np.full(128, index, dtype=np.float64)
+    if kind == "ndarray_1m":
+        return np.full(128 * 1024, index, dtype=np.float64)
+    raise ValueError(f"unknown local kind {kind!r}")
+
+
+def workload_source(shapes):
+    """Source of a module with one function per (capture, n_locals, depth)."""
+    lines = [
+        "import greenlet",
+        "import sauerkraut",
+        "",
+        "",
+        "def consume(*args):",
+        "    return args[-1]",
+        "",
+    ]
+    for capture, n_locals, depth in sorted(shapes):
+        params = [f"l{i}" for i in range(n_locals)]
+        live = ", ".join(params[: (n_locals + 1) // 2])
+        stack = "".join(f"{i}, " for i in range(depth))
+        if capture == "current":
+            # Keyword arguments rather than **options: frames resume after
+            # CALL and CALL_KW only.
+            suspend = (
+                "sauerkraut.copy_current_frame("
+                "serialize=options['serialize'], snapshot=options['snapshot'], "
+                "exclude_dead_locals=options['exclude_dead_locals'], "
+                "exclude_immutables=options['exclude_immutables'], "
+                "capture_module_source=options['capture_module_source'])"
+            )
+        else:
+            suspend = "greenlet.getcurrent().parent.switch()"
+        name = function_name(capture, n_locals, depth)
+        lines += [
+            "",
+            f"def {name}(options, {', '.join(params)}):",
+            f"    result = consume({stack}{suspend})",
+            f"    return result, ({live},)",
+            "",
+        ]
+    return "\n".join(lines)
+
+
+def function_name(capture, n_locals, depth):
+    return f"{capture}_{n_locals}_locals_{depth}_deep"
+
+
+def load_workloads(cases, directory):
+    shapes = {(c["capture"], c["n_locals"], c["stack_depth"]) for c in cases}
+    with open(os.path.join(directory, WORKLOAD_MODULE + ".py"), "w") as f:
+        f.write(workload_source(shapes))
+    sys.path.insert(0, directory)
+    return importlib.import_module(WORKLOAD_MODULE)
+
+
+def summarize(samples, frame_bytes):
+    samples = sorted(samples)
+    mean = statistics.fmean(samples)
+    p99 = samples[min(len(samples) - 1, int(len(samples) * 0.99))]
+    result = {
+        "p50_ns": samples[len(samples) // 2],
+        "p99_ns": p99,
+        "mean_ns": mean,
+        "frames_per_s": 1e9 / mean if mean else None,
+    }
+    if frame_bytes:
+        result["mb_per_s"] = frame_bytes / mean * 1e3 if mean else None
+    return result
+
+
+def run_case(sauerkraut, workloads, case, iterations, warmup):
+    import greenlet
+
+    fn = getattr(
+        workloads,
+        function_name(case["capture"], case["n_locals"], case["stack_depth"]),
+    )
+    values = [make_local(case["local_kind"], i) for i in range(case["n_locals"])]
+    options = {
+        "snapshot": case["snapshot"],
+        "exclude_dead_locals": case["exclude_dead_locals"],
+        "exclude_immutables": case["exclude_immutables"],
+        "capture_module_source": case["capture_module_source"],
+    }
+
+    if case["capture"] == "current":
+
+        def copy(serialize):
+            return fn(dict(options, serialize=serialize), *values)[0]
+
+    else:
+        gr = greenlet.greenlet(fn)
+        gr.switch(dict(options, serialize=False), *values)
+
+        def copy(serialize):
+            return sauerkraut.copy_frame_from_greenlet(gr, serialize=serialize, **options)
+
+    samples = {op: [] for op in OPERATIONS}
+    frame_bytes = 0
+    clock = time.perf_counter_ns
+    gc_was_enabled = gc.isenabled()
+    gc.disable()
+    try:
+        for i in range(warmup + iterations):
+            t0 = clock()
+            copied = copy(False)
+            t1 = clock()
+            sauerkraut.serialize_frame(
+                copied, capture_module_source=options["capture_module_source"]
+            )
+            t2 = clock()
+            frame = copy(True)
+            t3 = clock()
+            restored = sauerkraut.deserialize_frame(frame)
+            t4 = clock()
+            sauerkraut.run_frame(restored)
+            t5 = clock()
+            if i >= warmup:
+                samples["copy"].append(t1 - t0)
+                samples["serialize"].append(t2 - t1)
+                samples["copy_serialize"].append(t3 - t2)
+                samples["deserialize"].append(t4 - t3)
+                samples["run"].append(t5 - t4)
+                frame_bytes = len(frame)
+            del copied, frame, restored
+            gc.collect()
+    finally:
+        if gc_was_enabled:
+            gc.enable()
+
+    return {
+        "case": case,
+        "bytes_per_frame": frame_bytes,
+        "operations": {
+            op: summarize(samples[op], frame_bytes if op in SIZED_OPERATIONS else 0)
+            for op in OPERATIONS
+        },
+    }
+
+
+def make_cases(full):
+    if full:
+        keys = list(SWEEP)
+        cases = [dict(zip(keys, v)) for v in itertools.product(*SWEEP.values())]
+        # A hundred 1 MiB arrays per frame measures the allocator, not sauerkraut.
+        too_large = BASELINE["n_locals"]
+        return [
+            c
+            for c in cases
+            if c["local_kind"] != "ndarray_1m" or c["n_locals"] <= too_large
+        ]
+    cases = [dict(BASELINE)]
+    for key, values in SWEEP.items():
+        for value in values:
+            if value != BASELINE[key]:
+                cases.append(dict(BASELINE, **{key: value}))
+    return cases
+
+
+def environment(sauerkraut):
+    try:
+        from importlib.metadata import version
+
+        sauerkraut_version = version("sauerkraut")
+    except Exception:
+        sauerkraut_version = None
+    return {
+        "python": platform.python_version(),
+        "implementation": platform.python_implementation(),
+        "platform": platform.platform(),
+        "machine": platform.machine(),
+        "sauerkraut": sauerkraut_version,
+        "sauerkraut_path": os.path.dirname(sauerkraut.__file__),
+        "compression_codecs": sauerkraut.compression_codecs(),
+    }
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--iterations", type=int, default=200)
+    parser.add_argument("--warmup", type=int, default=20)
+    parser.add_argument("--full", action="store_true", help="run every combination")
+    parser.add_argument("--quick", action="store_true", help="few iterations, for CI")
+    parser.add_argument("--output", help="write JSON here instead of stdout")
+    parser.add_argument("--build-dir", help="CMake build tree holding _sauerkraut")
+    args = parser.parse_args(argv)
+    if args.quick:
+        args.iterations, args.warmup = 10, 2
+
+    if args.build_dir:
+        use_build_dir(args.build_dir)
+    import sauerkraut
+
+    cases = make_cases(args.full)
+    results = []
+    with tempfile.TemporaryDirectory(prefix="sauerkraut-bench-") as directory:
+        workloads = load_workloads(cases, directory)
+        for case in cases:
+            result = run_case(sauerkraut, workloads, case, args.iterations, args.warmup)
+            results.append(result)
+            ops = result["operations"]
+            print(
+                " ".join(f"{k}={v}" for k, v in case.items()),
+                " ".join(f"{op}={ops[op]['p50_ns'] / 1e3:.1f}us" for op in OPERATIONS),
+                f"bytes={result['bytes_per_frame']}",
+                file=sys.stderr,
+            )
+
+    report = {
+        "environment": environment(sauerkraut),
+        "iterations": args.iterations,
+        "warmup": args.warmup,
+        "results": results,
+    }
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(report, f, indent=2)
+    else:
+        json.dump(report, sys.stdout, indent=2)
+        print()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,99 @@
+#ifndef CHECKPOINT_WRITER_H
+#define CHECKPOINT_WRITER_H
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+
+// Writes finished checkpoints to files from a background thread, so the
+// thread that produced them does not wait for the disk. Each file is
+// written to a new "<path>.XXXXXX" temporary file, synced and renamed to
+// path, so path only ever holds a complete checkpoint. The writer never touches Python objects;
+// owners get their buffers back from reap().
+namespace checkpoint_writer {
+    struct Options {
+        // Open files with O_DIRECT. Data that is not aligned to
+        // DIRECT_ALIGNMENT goes through an aligned copy; frames serialized
+        // with aligned=True are written in place.
+        bool direct = false;
+        // Up to this many queued files are written before their fsyncs,
+        // renames and the directory fsync are done together.
+        size_t fsync_batch = 1;
+        // Writes kept in flight per file with io_uring.
+        unsigned queue_depth = 32;
+        // Use io_uring if sauerkraut was built with liburing and the
+        // kernel allows it; pwrite otherwise.
+        bool use_io_uring = true;
+    };
+
+    constexpr size_t DIRECT_ALIGNMENT = 4096;
+
+    struct Job {
+        uint64_t id;
+        std::string path;
+        const char *data;
+        size_t size;
+        // Opaque to the writer; handed back by reap().
+        void *owner;
+        // errno of the step that failed, 0 if the file was written.
+        int error = 0;
+        // The temporary file the job was written to, once created.
+        std::string tmp_path;
+        // Whether the file was opened with O_DIRECT, and how many bytes
+        // went through an aligned copy because data was not aligned.
+        bool direct = false;
+        size_t bounced = 0;
+    };
+
+    class Writer {
+        public:
+        explicit Writer(const Options &options);
+        ~Writer();
+        Writer(const Writer &) = delete;
+        Writer &operator=(const Writer &) = delete;
+
+        // Queue size bytes at data for path. data must stay valid until the
+        // job comes back from reap().
+        uint64_t submit(std::string path, const char *data, size_t size, void *owner);
+        // Block until every submitted job is finished.
+        void drain();
+        // Finished jobs, oldest first.
+        std::vector<Job> reap();
+        // Jobs submitted and not yet finished.
+        size_t in_flight();
+        // Finish the queued jobs and stop the thread. submit() must not be
+        // called afterwards.
+        void close();
+        // "io_uring" or "pwrite".
+        const char *backend() const;
+
+        private:
+        struct Uring;
+
+        Options options;
+        mode_t file_umask = 0;
+        std::unique_ptr<Uring> uring;
+        std::mutex mutex;
+        std::condition_variable queued;
+        std::condition_variable finished;
+        std::deque<Job> queue;
+        std::vector<Job> done;
+        size_t n_in_flight = 0;
+        uint64_t next_id = 0;
+        bool stopping = false;
+        std::thread thread;
+
+        void run();
+        void write_batch(std::vector<Job> &batch);
+        int write_file(Job &job, int &fd);
+        int write_at(int fd, const char *data, size_t size, size_t offset);
+    };
+}
+
+#endif
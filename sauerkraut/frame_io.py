@@ -0,0 +1,171 @@
+"""Scatter-gather file I/O for frames serialized with ``out_of_band=True``.
+
+A frame file holds the serialized frame followed by each out-of-band buffer,
+every segment starting on an ``alignment`` boundary:
+
+    header | pad | frame | pad | buffer 0 | pad | buffer 1 | ...
+
+The header is ``MAGIC``, the alignment, the number of segments and one
+64-bit size per segment.  Writing hands every segment to ``os.writev``
+without concatenating them first, and reading maps the file so that the
+restored buffers (and the arrays unpickled from them) point straight into
+the mapping instead of into copies.  ``deserialize_frame_from_file`` does
+the same for any frame file, so restoring never needs a copy of the file in
+memory.
+"""
+
+import mmap
+import os
+import struct
+
+from ._sauerkraut import deserialize_frame
+
+MAGIC = b"SKFRMIO1"
+DEFAULT_ALIGNMENT = 64
+
+_HEADER = struct.Struct("<8sII")
+_SIZE = struct.Struct("<Q")
+
+
+def _iov_max():
+    try:
+        return os.sysconf("SC_IOV_MAX")
+    except (AttributeError, ValueError, OSError):
+        return 1024
+
+
+def _padding(offset, alignment):
+    return -offset % alignment
+
+
+def _writev_all(fd, views):
+    """Write every view in ``views``, retrying on partial writes."""
+    iov_max = _iov_max()
+    written = 0
+    i = 0
+    while i < len(views):
+        batch = views[i : i + iov_max]
+        n = os.writev(fd, batch)
+        written += n
+        # Skip over fully written views and trim the partially written one.
+        while batch and n >= len(batch[0]):
+            n -= len(batch[0])
+            batch.pop(0)
+            i += 1
+        if n:
+            views[i] = views[i][n:]
+    return written
+
+
+def write_frame(file, frame, buffers=(), alignment=DEFAULT_ALIGNMENT):
+    """Write a serialized frame and its out-of-band buffers to ``file``.
+
+    Args:
+        file: A path or an object with a ``fileno()`` method.
+        frame: The serialized frame.
+        buffers: The out-of-band buffers returned next to the frame.
+        alignment: Segment alignment in bytes; must be a power of two.
+
+    Returns:
+        The number of bytes written.
+    """
+    if alignment <= 0 or alignment & (alignment - 1):
+        raise ValueError("alignment must be a power of two")
+
+    segments = [memoryview(frame).cast("B")]
+    segments.extend(memoryview(b).cast("B") for b in buffers)
+
+    header = bytearray(_HEADER.pack(MAGIC, alignment, len(segments)))
+    for segment in segments:
+        header += _SIZE.pack(len(segment))
+    zeros = bytes(alignment)
+
+    views = [memoryview(header)]
+    offset = len(header)
+    for segment in segments:
+        pad = _padding(offset, alignment)
+        if pad:
+            views.append(memoryview(zeros)[:pad])
+        views.append(segment)
+        offset += pad + len(segment)
+
+    if hasattr(file, "fileno"):
+        if hasattr(file, "flush"):
+            file.flush()
+        return _writev_all(file.fileno(), views)
+
+    fd = os.open(file, os.O_WRONLY | os.O_CREAT | os.O_TRUNC, 0o644)
+    try:
+        return _writev_all(fd, views)
+    finally:
+        os.close(fd)
+
+
+def read_frame(path, writable=True):
+    """Map a file written by ``write_frame``.
+
+    Args:
+        path: The file to read.
+        writable: Map the file copy-on-write so restored arrays can be
+            modified without touching the file.  With ``False`` the buffers
+            are read-only.
+
+    Returns:
+        ``(frame, buffers)``, ready for
+        ``deserialize_frame(frame, buffers=buffers)``.
+    """
+    view = _map(path, writable)
+    if not _is_segment_file(view):
+        raise ValueError(f"{path} is not a sauerkraut frame file")
+    return _split_segments(view, path)
+
+
+def deserialize_frame_from_file(path, **kwargs):
+    """Deserialize a frame straight out of a memory-mapped file.
+
+    ``path`` may hold a bare serialized frame or a file written by
+    ``write_frame``; in the latter case the out-of-band buffers are passed
+    along automatically.  Nothing is read into an intermediate copy: every
+    local is unpickled from the mapping.  Keyword arguments are forwarded to
+    ``deserialize_frame``.
+    """
+    view = _map(path, writable=True)
+    if _is_segment_file(view):
+        frame, buffers = _split_segments(view, path)
+        kwargs.setdefault("buffers", buffers)
+        return deserialize_frame(frame, **kwargs)
+    try:
+        return deserialize_frame(view, **kwargs)
+    finally:
+        view.release()
+
+
+def _map(path, writable):
+    with open(path, "rb") as f:
+        access = mmap.ACCESS_COPY if writable else mmap.ACCESS_READ
+        return memoryview(mmap.mmap(f.fileno(), 0, access=access))
+
+
+def _is_segment_file(view):
+    return len(view) >= _HEADER.size and view[: len(MAGIC)] == MAGIC
+
+
+def _split_segments(view, path):
+    _, alignment, n_segments = _HEADER.unpack_from(view, 0)
+
+    offset = _HEADER.size
+    sizes = []
+    for _ in range(n_segments):
+        (size,) = _SIZE.unpack_from(view, offset)
+        sizes.append(size)
+        offset += _SIZE.size
+
+    segments = []
+    for size in sizes:
+        offset += _padding(offset, alignment)
+        if offset + size > len(view):
+            raise ValueError(f"{path} is truncated")
+        segments.append(view[offset : offset + size])
+        offset += size
+
+    return segments[0], segments[1:]
@@ -0,0 +1,174 @@
+#ifndef BYTECODE_HH_INCLUDED
+#define BYTECODE_HH_INCLUDED
+#include "sauerkraut_cpython_compat.h"
+#include <opcode_ids.h>
+#include <cstdint>
+#include <vector>
+
+namespace sauerkraut {
+    // Defined in code_info.h, which includes this file.
+    inline PyObject *get_deopt_code(PyCodeObject *code);
+}
+
+// Decoding of a code object's bytecode for the analyses sauerkraut caches
+// per code object (liveness, stack depths). Offsets are in code units.
+namespace sauerkraut::bytecode {
+    struct Instruction {
+        uint32_t start;   // including EXTENDED_ARG prefixes
+        uint32_t offset;  // of the opcode itself
+        uint32_t next;    // after the inline caches
+        int opcode;
+        int oparg;
+    };
+
+    struct ExceptionEntry {
+        uint32_t start;
+        uint32_t end;
+        uint32_t target;
+        int depth;
+        bool lasti;
+    };
+
+    struct Decoded {
+        std::vector<Instruction> instrs;
+        // The instruction each code unit belongs to.
+        std::vector<int> unit_to_instr;
+
+        // The instruction at unit, or -1 if unit is out of range.
+        int instr_at(long unit) const {
+            if (unit < 0 || unit >= (long) unit_to_instr.size()) {
+                return -1;
+            }
+            return unit_to_instr[unit];
+        }
+    };
+
+    // get_deopt_code returns the unspecialized bytecode, whose inline
+    // caches are all zero, i.e. CACHE.
+    // Returns false with an exception set on failure.
+    inline bool decode(PyCodeObject *code, Decoded &decoded) {
+        PyObject *code_bytes = get_deopt_code(code);
+        if (code_bytes == NULL) {
+            return false;
+        }
+        const uint8_t *units = (const uint8_t *) PyBytes_AS_STRING(code_bytes);
+        uint32_t n_units = (uint32_t) (PyBytes_GET_SIZE(code_bytes) / 2);
+        decoded.instrs.clear();
+        decoded.unit_to_instr.assign(n_units, -1);
+
+        for (uint32_t i = 0; i < n_units;) {
+            Instruction instr;
+            int index = (int) decoded.instrs.size();
+            int oparg = 0;
+            instr.start = i;
+            while (i < n_units && units[2 * i] == EXTENDED_ARG) {
+                oparg = (oparg | units[2 * i + 1]) << 8;
+                decoded.unit_to_instr[i++] = index;
+            }
+            if (i == n_units) {
+                break;
+            }
+            instr.offset = i;
+            instr.opcode = units[2 * i];
+            instr.oparg = oparg | units[2 * i + 1];
+            decoded.unit_to_instr[i++] = index;
+            while (i < n_units && units[2 * i] == CACHE) {
+                decoded.unit_to_instr[i++] = index;
+            }
+            instr.next = i;
+            decoded.instrs.push_back(instr);
+        }
+        return true;
+    }
+
+    inline bool is_backward_jump(int opcode) {
+        switch (opcode) {
+            case JUMP_BACKWARD:
+            case JUMP_BACKWARD_NO_INTERRUPT:
+#if SAUERKRAUT_PY314
+            case END_ASYNC_FOR:
+#endif
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    inline bool is_forward_jump(int opcode) {
+        switch (opcode) {
+            case JUMP_FORWARD:
+            case POP_JUMP_IF_FALSE:
+            case POP_JUMP_IF_TRUE:
+            case POP_JUMP_IF_NONE:
+            case POP_JUMP_IF_NOT_NONE:
+            case FOR_ITER:
+            case SEND:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // The unit instr jumps to, or -1 if it does not jump.
+    inline long jump_target(const Instruction &instr) {
+        if (is_backward_jump(instr.opcode)) {
+            return (long) instr.next - instr.oparg;
+        }
+        if (is_forward_jump(instr.opcode)) {
+            return (long) instr.next + instr.oparg;
+        }
+        return -1;
+    }
+
+    inline bool falls_through(int opcode) {
+        switch (opcode) {
+            case JUMP_FORWARD:
+            case JUMP_BACKWARD:
+            case JUMP_BACKWARD_NO_INTERRUPT:
+            case RETURN_VALUE:
+#ifdef RETURN_CONST
+            case RETURN_CONST:
+#endif
+            case RAISE_VARARGS:
+            case RERAISE:
+                return false;
+            default:
+                return true;
+        }
+    }
+
+    namespace detail {
+        inline int read_varint(const uint8_t *&p, const uint8_t *end) {
+            int value = *p & 63;
+            while ((*p++ & 64) && p < end) {
+                value = (value << 6) | (*p & 63);
+            }
+            return value;
+        }
+    }
+
+    // Entries are (start, size, target, depth and lasti), each a varint of
+    // 6-bit chunks; see Objects/exception_handling_notes.txt.
+    inline std::vector<ExceptionEntry> exception_entries(PyCodeObject *code) {
+        std::vector<ExceptionEntry> entries;
+        PyObject *table = code->co_exceptiontable;
+        const uint8_t *p = (const uint8_t *) PyBytes_AS_STRING(table);
+        const uint8_t *end = p + PyBytes_GET_SIZE(table);
+        while (p < end) {
+            ExceptionEntry entry;
+            entry.start = detail::read_varint(p, end);
+            if (p >= end) break;
+            entry.end = entry.start + detail::read_varint(p, end);
+            if (p >= end) break;
+            entry.target = detail::read_varint(p, end);
+            if (p >= end) break;
+            int depth_lasti = detail::read_varint(p, end);
+            entry.depth = depth_lasti >> 1;
+            entry.lasti = depth_lasti & 1;
+            entries.push_back(entry);
+        }
+        return entries;
+    }
+}
+
+#endif // BYTECODE_HH_INCLUDED
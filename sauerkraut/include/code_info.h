@@ -0,0 +1,195 @@
+#ifndef CODE_INFO_HH_INCLUDED
+#define CODE_INFO_HH_INCLUDED
+#include "sauerkraut_cpython_compat.h"
+#include <marshal.h>
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include "hash.h"
+#include "liveness.h"
+#include "stack_depth.h"
+#include "stats.h"
+
+namespace sauerkraut {
+    // Maps the names in co_localsplusnames to their slots. The compiler
+    // interns these names, so lookups hash the string pointer; an equal
+    // string that is not the interned object falls back to a scan.
+    class LocalNameIndex {
+        PyObject *names;  // borrowed; the code object outlives its CodeInfo
+        std::unordered_map<PyObject *, int> slots;
+
+        public:
+        explicit LocalNameIndex(PyCodeObject *code) : names(code->co_localsplusnames) {
+            Py_ssize_t n = PyTuple_GET_SIZE(names);
+            slots.reserve(n);
+            for (Py_ssize_t i = 0; i < n; i++) {
+                slots.emplace(PyTuple_GET_ITEM(names, i), (int) i);
+            }
+        }
+
+        // The slot of the local called name, or -1 if there is none.
+        int find(PyObject *name) const {
+            auto it = slots.find(name);
+            if (it != slots.end()) {
+                return it->second;
+            }
+            if (PyUnicode_CHECK_INTERNED(name)) {
+                return -1;
+            }
+            Py_ssize_t n = PyTuple_GET_SIZE(names);
+            for (Py_ssize_t i = 0; i < n; i++) {
+                if (PyUnicode_Compare(PyTuple_GET_ITEM(names, i), name) == 0) {
+                    return (int) i;
+                }
+            }
+            return -1;
+        }
+    };
+
+    // What sauerkraut learns about a code object over time. It is stored in
+    // the code object's co_extra slot, so it is freed together with the code.
+    struct CodeInfo {
+        // The unspecialized bytecode, as PyCode_GetCode returns it.
+        PyObject *deopt_code = NULL;
+        // Decaying maximum of the sizes frames of this code serialized to.
+        size_t serialized_size = 0;
+        // Content hash of the code, computed on first use.
+        std::optional<utils::hash::Hash128> content_hash;
+        // Dead locals per instruction, computed on first use.
+        std::unique_ptr<Liveness> liveness;
+        // Stack depth at each call, computed on first use.
+        std::unique_ptr<StackDepths> stack_depths;
+        // Slots of the local names, built on first use.
+        std::unique_ptr<LocalNameIndex> local_names;
+
+        void record_serialized_size(size_t size) {
+            serialized_size = std::max(size, serialized_size - serialized_size / 8);
+        }
+
+        // Initial builder size for the next frame of this code; 0 if no
+        // frame of it has been serialized yet.
+        size_t size_hint() const {
+            return serialized_size + serialized_size / 8;
+        }
+
+        ~CodeInfo() {
+            Py_XDECREF(deopt_code);
+        }
+    };
+
+    inline void free_code_info(void *info) {
+        delete static_cast<CodeInfo *>(info);
+    }
+
+    // The co_extra slot CodeInfo lives in, from
+    // PyUnstable_Eval_RequestCodeExtraIndex(free_code_info) at module init.
+    inline Py_ssize_t code_extra_index = -1;
+
+    // The CodeInfo of code, created on first use.
+    // Returns NULL with an exception set on failure.
+    inline CodeInfo *get_code_info(PyCodeObject *code) {
+        void *extra = NULL;
+        if (PyUnstable_Code_GetExtra((PyObject *) code, code_extra_index, &extra) < 0) {
+            return NULL;
+        }
+        if (extra != NULL) {
+            return static_cast<CodeInfo *>(extra);
+        }
+        CodeInfo *info = new CodeInfo();
+        if (PyUnstable_Code_SetExtra((PyObject *) code, code_extra_index, info) < 0) {
+            delete info;
+            return NULL;
+        }
+        return info;
+    }
+
+    // The CodeInfo of code if it has one. Never allocates or raises, so it
+    // is safe to call while code is being destroyed.
+    inline CodeInfo *find_code_info(PyCodeObject *code) {
+        void *extra = NULL;
+        if (PyUnstable_Code_GetExtra((PyObject *) code, code_extra_index, &extra) < 0) {
+            PyErr_Clear();
+            return NULL;
+        }
+        return static_cast<CodeInfo *>(extra);
+    }
+
+    // The unspecialized bytecode of code, fetched once and kept until code
+    // is freed. Returns a borrowed reference, or NULL with an exception set.
+    inline PyObject *get_deopt_code(PyCodeObject *code) {
+        CodeInfo *info = get_code_info(code);
+        if (info == NULL) {
+            return NULL;
+        }
+        if (info->deopt_code == NULL) {
+            info->deopt_code = PyCode_GetCode(code);
+        }
+        return info->deopt_code;
+    }
+
+    // The liveness of code's locals, computed on first use.
+    // Returns NULL with an exception set on failure.
+    inline const Liveness *get_liveness(PyCodeObject *code) {
+        CodeInfo *info = get_code_info(code);
+        if (info == NULL) {
+            return NULL;
+        }
+        if (!info->liveness) {
+            stats::add(stats::LIVENESS_CACHE_MISSES);
+            info->liveness = Liveness::analyze(code);
+        } else {
+            stats::add(stats::LIVENESS_CACHE_HITS);
+        }
+        return info->liveness.get();
+    }
+
+    // The stack depths at code's calls, computed on first use.
+    // Returns NULL with an exception set on failure.
+    inline const StackDepths *get_stack_depths(PyCodeObject *code) {
+        CodeInfo *info = get_code_info(code);
+        if (info == NULL) {
+            return NULL;
+        }
+        if (!info->stack_depths) {
+            info->stack_depths = StackDepths::analyze(code);
+        }
+        return info->stack_depths.get();
+    }
+
+    // Returns NULL with an exception set on failure.
+    inline const LocalNameIndex *get_local_names(PyCodeObject *code) {
+        CodeInfo *info = get_code_info(code);
+        if (info == NULL) {
+            return NULL;
+        }
+        if (!info->local_names) {
+            info->local_names.reset(new LocalNameIndex(code));
+        }
+        return info->local_names.get();
+    }
+
+    // Hash of everything that makes up code: marshal covers the bytecode,
+    // constants, names, qualname, filename, first line number and tables.
+    // Version 0 leaves out reference and interning flags, which depend on
+    // refcounts rather than on the code itself.
+    // Returns nullopt with an exception set on failure.
+    inline std::optional<utils::hash::Hash128> code_content_hash(PyCodeObject *code) {
+        CodeInfo *info = get_code_info(code);
+        if (info == NULL) {
+            return std::nullopt;
+        }
+        if (!info->content_hash) {
+            PyObject *marshalled = PyMarshal_WriteObjectToString((PyObject *) code, 0);
+            if (marshalled == NULL) {
+                return std::nullopt;
+            }
+            info->content_hash = utils::hash::hash128(PyBytes_AS_STRING(marshalled), PyBytes_GET_SIZE(marshalled));
+            Py_DECREF(marshalled);
+        }
+        return info->content_hash;
+    }
+}
+
+#endif // CODE_INFO_HH_INCLUDED
@@ -0,0 +1,160 @@
+#ifndef FRAME_ALLOCATOR_HH_INCLUDED
+#define FRAME_ALLOCATOR_HH_INCLUDED
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+namespace sauerkraut {
+    // Memory for the interpreter frames of copied and deserialized frames.
+    // Frames are carved out of slabs by bumping a pointer. A freed frame
+    // goes onto the free list of its size class and is handed to the next
+    // frame of that class, so once the pool is warm an allocation pops a
+    // list. Frames bigger than MAX_POOLED_SIZE, and frames allocated while
+    // the slabs are at the limit, come from malloc instead.
+    //
+    // Frames are freed wherever their capsule dies, which need not be the
+    // thread that allocated them, so there is one pool per process. As with
+    // serdes::PooledAllocator, all calls happen with the GIL held.
+    class FrameAllocator {
+        public:
+        // Sizes are rounded up to a multiple of this many bytes.
+        static constexpr size_t GRANULE = 64;
+        static constexpr size_t MAX_POOLED_SIZE = 16 << 10;
+        static constexpr size_t SLAB_SIZE = 256 << 10;
+        static constexpr size_t DEFAULT_LIMIT = 64 << 20;
+
+        private:
+        static constexpr size_t N_CLASSES = MAX_POOLED_SIZE / GRANULE;
+        static constexpr uint32_t UNPOOLED = UINT32_MAX;
+
+        // In front of every frame; its size keeps frames aligned like malloc's.
+        struct alignas(16) Header {
+            uint32_t size_class;
+        };
+        // A free block keeps its list link where the header was.
+        struct FreeBlock {
+            FreeBlock *next;
+        };
+
+        FreeBlock *free_lists[N_CLASSES] = {};
+        std::vector<void *> slabs;
+        uint8_t *bump = nullptr;
+        uint8_t *bump_end = nullptr;
+        size_t limit = DEFAULT_LIMIT;
+        // Pooled frames handed out and not freed yet.
+        size_t live = 0;
+
+        FrameAllocator() = default;
+
+        static size_t block_size(uint32_t size_class) {
+            return sizeof(Header) + (size_class + 1) * GRANULE;
+        }
+
+        bool new_slab() {
+            if ((slabs.size() + 1) * SLAB_SIZE > limit) {
+                return false;
+            }
+            void *slab = std::malloc(SLAB_SIZE);
+            if (slab == nullptr) {
+                return false;
+            }
+            slabs.push_back(slab);
+            bump = static_cast<uint8_t *>(slab);
+            bump_end = bump + SLAB_SIZE;
+            return true;
+        }
+
+        // Only possible while no pooled frame is alive.
+        void release_slabs() {
+            for (void *slab : slabs) {
+                std::free(slab);
+            }
+            slabs.clear();
+            for (auto &list : free_lists) {
+                list = nullptr;
+            }
+            bump = bump_end = nullptr;
+        }
+
+        void *allocate_unpooled(size_t size) {
+            Header *header = static_cast<Header *>(std::malloc(sizeof(Header) + size));
+            if (header == nullptr) {
+                return nullptr;
+            }
+            header->size_class = UNPOOLED;
+            return header + 1;
+        }
+
+        public:
+        FrameAllocator(const FrameAllocator &) = delete;
+        FrameAllocator &operator=(const FrameAllocator &) = delete;
+
+        // Never destroyed: frames may outlive every other static object.
+        static FrameAllocator &instance() {
+            static FrameAllocator *allocator = new FrameAllocator();
+            return *allocator;
+        }
+
+        void *allocate(size_t size) {
+            if (size == 0 || size > MAX_POOLED_SIZE) {
+                return allocate_unpooled(size);
+            }
+            uint32_t size_class = (uint32_t) ((size + GRANULE - 1) / GRANULE - 1);
+            Header *header;
+            if (free_lists[size_class] != nullptr) {
+                FreeBlock *block = free_lists[size_class];
+                free_lists[size_class] = block->next;
+                header = reinterpret_cast<Header *>(block);
+            } else {
+                size_t needed = block_size(size_class);
+                if ((size_t) (bump_end - bump) < needed && !new_slab()) {
+                    return allocate_unpooled(size);
+                }
+                header = reinterpret_cast<Header *>(bump);
+                bump += needed;
+            }
+            header->size_class = size_class;
+            live++;
+            return header + 1;
+        }
+
+        void free(void *frame) {
+            if (frame == nullptr) {
+                return;
+            }
+            Header *header = static_cast<Header *>(frame) - 1;
+            if (header->size_class == UNPOOLED) {
+                std::free(header);
+                return;
+            }
+            uint32_t size_class = header->size_class;
+            FreeBlock *block = reinterpret_cast<FreeBlock *>(header);
+            block->next = free_lists[size_class];
+            free_lists[size_class] = block;
+            live--;
+            if (live == 0 && slab_bytes() > limit) {
+                release_slabs();
+            }
+        }
+
+        size_t slab_bytes() const {
+            return slabs.size() * SLAB_SIZE;
+        }
+
+        size_t get_limit() const {
+            return limit;
+        }
+
+        // Caps the memory the pool keeps in slabs. Slabs above a lowered
+        // limit are released once no pooled frame is alive.
+        void set_limit(size_t bytes) {
+            limit = bytes;
+            if (live == 0 && slab_bytes() > limit) {
+                release_slabs();
+            }
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef FRAME_HEADER_HH_INCLUDED
+#define FRAME_HEADER_HH_INCLUDED
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include "flatbuffers/flatbuffers.h"
+
+namespace sauerkraut {
+    // Every serialized frame starts with a FrameHeader, followed by the
+    // function's name, qualified name and module name (UTF-8, in that order,
+    // not terminated), zero padding up to header_size, and then the
+    // PyFrame flatbuffer. The header holds what is needed to route a frame
+    // without reading the flatbuffer or unpickling anything. Fields are in
+    // native byte order, which is little-endian on every supported platform.
+    struct FrameHeader {
+        char magic[4];
+        uint16_t version;
+        uint16_t flags;
+        // Bytes before the flatbuffer: this struct, the names and padding.
+        uint32_t header_size;
+        // Byte offset of the instruction the frame resumes at.
+        uint32_t instr_offset;
+        // Size of the flatbuffer.
+        uint64_t frame_size;
+        // code_content_hash of the frame's code.
+        uint64_t code_hash_low;
+        uint64_t code_hash_high;
+        // checkpoint_id of the frame a delta was taken against, 0 otherwise.
+        uint64_t base_id;
+        // Out-of-band buffers that travel next to the frame.
+        uint32_t n_buffers;
+        uint32_t name_size;
+        uint32_t qualname_size;
+        uint32_t module_name_size;
+    };
+    static_assert(sizeof(FrameHeader) == 64, "FrameHeader must stay 64 bytes");
+
+    constexpr char FRAME_MAGIC[4] = {'S', 'K', 'F', 'R'};
+    constexpr uint16_t FRAME_VERSION = 1;
+    // The flatbuffer keeps the alignment it was built with.
+    constexpr size_t FRAME_HEADER_ALIGNMENT = 8;
+
+    enum FrameFlags : uint16_t {
+        FRAME_OUT_OF_BAND = 1 << 0,
+        FRAME_INCREMENTAL = 1 << 1,
+        FRAME_DELTA = 1 << 2,
+        FRAME_EXCLUDES_CODE = 1 << 3,
+        FRAME_MODULE_SOURCE = 1 << 4,
+    };
+
+    struct FrameNames {
+        std::string_view name;
+        std::string_view qualname;
+        std::string_view module_name;
+    };
+
+    // Call after builder.Finish(): puts the header and the names in front
+    // of the flatbuffer. Fills in the sizes; the caller sets the rest.
+    // With a larger alignment, the header is padded until the whole frame
+    // is a multiple of it long; the flatbuffer must then have been
+    // finished to a multiple of FRAME_HEADER_ALIGNMENT.
+    inline void prepend_frame_header(flatbuffers::FlatBufferBuilder &builder, FrameHeader header, const FrameNames &names,
+                                     size_t alignment = FRAME_HEADER_ALIGNMENT) {
+        std::memcpy(header.magic, FRAME_MAGIC, sizeof(FRAME_MAGIC));
+        header.version = FRAME_VERSION;
+        header.frame_size = builder.GetSize();
+        header.name_size = (uint32_t) names.name.size();
+        header.qualname_size = (uint32_t) names.qualname.size();
+        header.module_name_size = (uint32_t) names.module_name.size();
+        size_t used = sizeof(FrameHeader) + names.name.size() + names.qualname.size() + names.module_name.size();
+        size_t padding = (FRAME_HEADER_ALIGNMENT - used % FRAME_HEADER_ALIGNMENT) % FRAME_HEADER_ALIGNMENT;
+        if (alignment > FRAME_HEADER_ALIGNMENT) {
+            size_t total = used + header.frame_size;
+            padding = (alignment - total % alignment) % alignment;
+        }
+        header.header_size = (uint32_t) (used + padding);
+
+        // The builder grows towards the front, so push back to front.
+        builder.Pad(padding);
+        builder.PushBytes(reinterpret_cast<const uint8_t *>(names.module_name.data()), names.module_name.size());
+        builder.PushBytes(reinterpret_cast<const uint8_t *>(names.qualname.data()), names.qualname.size());
+        builder.PushBytes(reinterpret_cast<const uint8_t *>(names.name.data()), names.name.size());
+        builder.PushBytes(reinterpret_cast<const uint8_t *>(&header), sizeof(header));
+    }
+
+    // Checks the header at the front of size bytes at data. Returns NULL and
+    // fills in header and names, or returns why the data is not a frame.
+    inline const char *read_frame_header(const uint8_t *data, size_t size, FrameHeader &header, FrameNames *names = nullptr) {
+        if (size < sizeof(FrameHeader)) {
+            return "buffer is too small to hold a serialized frame";
+        }
+        std::memcpy(&header, data, sizeof(FrameHeader));
+        if (std::memcmp(header.magic, FRAME_MAGIC, sizeof(FRAME_MAGIC)) != 0) {
+            return "buffer does not hold a serialized frame";
+        }
+        if (header.version != FRAME_VERSION) {
+            return "serialized frame has an unsupported version";
+        }
+        uint64_t names_size = (uint64_t) header.name_size + header.qualname_size + header.module_name_size;
+        if (header.header_size < sizeof(FrameHeader) + names_size ||
+            header.header_size % FRAME_HEADER_ALIGNMENT != 0 ||
+            (uint64_t) header.header_size + header.frame_size > size) {
+            return "serialized frame is truncated";
+        }
+        if (names != nullptr) {
+            const char *at = reinterpret_cast<const char *>(data) + sizeof(FrameHeader);
+            names->name = std::string_view(at, header.name_size);
+            at += header.name_size;
+            names->qualname = std::string_view(at, header.qualname_size);
+            at += header.qualname_size;
+            names->module_name = std::string_view(at, header.module_name_size);
+        }
+        return nullptr;
+    }
+}
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef HASH_HH_INCLUDED
+#define HASH_HH_INCLUDED
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// XXH64, used to recognise object payloads that did not change between
+// checkpoints. Output matches the reference implementation.
+namespace utils {
+    namespace hash {
+        namespace detail {
+            constexpr uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+            constexpr uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+            constexpr uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+            constexpr uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+            constexpr uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+            inline uint64_t rotl(uint64_t x, int r) {
+                return (x << r) | (x >> (64 - r));
+            }
+
+            inline uint64_t read64(const uint8_t *p) {
+                uint64_t v;
+                memcpy(&v, p, sizeof(v));
+                return v;
+            }
+
+            inline uint32_t read32(const uint8_t *p) {
+                uint32_t v;
+                memcpy(&v, p, sizeof(v));
+                return v;
+            }
+
+            inline uint64_t round(uint64_t acc, uint64_t input) {
+                acc += input * PRIME2;
+                acc = rotl(acc, 31);
+                return acc * PRIME1;
+            }
+
+            inline uint64_t merge_round(uint64_t acc, uint64_t val) {
+                acc ^= round(0, val);
+                return acc * PRIME1 + PRIME4;
+            }
+        }
+
+        // Assumes a little-endian host, like the rest of the frame format.
+        inline uint64_t xxh64(const void *data, size_t size, uint64_t seed = 0) {
+            using namespace detail;
+            const uint8_t *p = static_cast<const uint8_t *>(data);
+            const uint8_t *end = p + size;
+            uint64_t h;
+
+            if (size >= 32) {
+                uint64_t v1 = seed + PRIME1 + PRIME2;
+                uint64_t v2 = seed + PRIME2;
+                uint64_t v3 = seed;
+                uint64_t v4 = seed - PRIME1;
+                const uint8_t *limit = end - 32;
+                do {
+                    v1 = round(v1, read64(p));
+                    v2 = round(v2, read64(p + 8));
+                    v3 = round(v3, read64(p + 16));
+                    v4 = round(v4, read64(p + 24));
+                    p += 32;
+                } while (p <= limit);
+                h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+                h = merge_round(h, v1);
+                h = merge_round(h, v2);
+                h = merge_round(h, v3);
+                h = merge_round(h, v4);
+            } else {
+                h = seed + PRIME5;
+            }
+            h += (uint64_t) size;
+
+            while (p + 8 <= end) {
+                h ^= round(0, read64(p));
+                h = rotl(h, 27) * PRIME1 + PRIME4;
+                p += 8;
+            }
+            if (p + 4 <= end) {
+                h ^= (uint64_t) read32(p) * PRIME1;
+                h = rotl(h, 23) * PRIME2 + PRIME3;
+                p += 4;
+            }
+            while (p < end) {
+                h ^= (*p) * PRIME5;
+                h = rotl(h, 11) * PRIME1;
+                p++;
+            }
+
+            h ^= h >> 33;
+            h *= PRIME2;
+            h ^= h >> 29;
+            h *= PRIME3;
+            h ^= h >> 32;
+            return h;
+        }
+
+        // 128 bits from two XXH64 passes with different seeds; used where a
+        // 64-bit collision would silently mix up two code objects.
+        struct Hash128 {
+            uint64_t low = 0;
+            uint64_t high = 0;
+
+            bool operator==(const Hash128 &other) const {
+                return low == other.low && high == other.high;
+            }
+        };
+
+        struct Hash128Hasher {
+            size_t operator()(const Hash128 &h) const {
+                return (size_t) h.low;
+            }
+        };
+
+        inline Hash128 hash128(const void *data, size_t size) {
+            return {xxh64(data, size, 0), xxh64(data, size, detail::PRIME5)};
+        }
+    }
+}
+
+#endif // HASH_HH_INCLUDED
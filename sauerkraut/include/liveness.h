@@ -0,0 +1,233 @@
+#ifndef LIVENESS_HH_INCLUDED
+#define LIVENESS_HH_INCLUDED
+#include "sauerkraut_cpython_compat.h"
+#include <opcode_ids.h>
+#include "bytecode.h"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace sauerkraut {
+    // Which fast locals of a code object are dead after each instruction.
+    // A local is dead when no path from that point reads it before writing
+    // it again, counting the paths into exception handlers. Cells and free
+    // variables are never dead: closures may still read them.
+    //
+    // Consecutive instructions usually share their dead set, so a set is
+    // only stored where it changes.
+    class Liveness {
+        public:
+        using Word = uint64_t;
+        static constexpr int WORD_BITS = 64;
+        // Kinds in co_localspluskinds, from Include/internal/pycore_code.h.
+        static constexpr uint8_t FAST_CELL = 0x40;
+        static constexpr uint8_t FAST_FREE = 0x80;
+
+        private:
+        // A read or write of a local, in the order the instruction does them.
+        struct Access {
+            int local;
+            bool write;
+        };
+
+        struct Instruction : bytecode::Instruction {
+            Access access[2];
+            int n_access = 0;
+            int successor[2];
+            int n_successor = 0;
+            int handler = -1;
+
+            Instruction(const bytecode::Instruction &instr) : bytecode::Instruction(instr) {}
+        };
+
+        int nlocalsplus;
+        size_t words;
+        std::vector<uint32_t> run_starts;  // code units, ascending
+        std::vector<Word> run_dead;        // words per run
+
+        Liveness(int nlocalsplus) :
+            nlocalsplus(nlocalsplus), words((nlocalsplus + WORD_BITS - 1) / WORD_BITS) {}
+
+        static void find_accesses(Instruction &instr) {
+            int hi = instr.oparg >> 4;
+            int lo = instr.oparg & 15;
+            switch (instr.opcode) {
+                case LOAD_FAST:
+                case LOAD_FAST_CHECK:
+                case LOAD_FAST_AND_CLEAR:
+#if SAUERKRAUT_PY314
+                case LOAD_FAST_BORROW:
+#endif
+                    instr.access[instr.n_access++] = {instr.oparg, false};
+                    break;
+                case STORE_FAST:
+                case DELETE_FAST:
+                    instr.access[instr.n_access++] = {instr.oparg, true};
+                    break;
+                case LOAD_FAST_LOAD_FAST:
+#if SAUERKRAUT_PY314
+                case LOAD_FAST_BORROW_LOAD_FAST_BORROW:
+#endif
+                    instr.access[instr.n_access++] = {hi, false};
+                    instr.access[instr.n_access++] = {lo, false};
+                    break;
+                case STORE_FAST_STORE_FAST:
+                    instr.access[instr.n_access++] = {hi, true};
+                    instr.access[instr.n_access++] = {lo, true};
+                    break;
+                case STORE_FAST_LOAD_FAST:
+                    instr.access[instr.n_access++] = {hi, true};
+                    instr.access[instr.n_access++] = {lo, false};
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        bool set_equal(const Word *a, const Word *b) const {
+            return std::equal(a, a + words, b);
+        }
+
+        public:
+        // Returns NULL with an exception set on failure.
+        static std::unique_ptr<Liveness> analyze(PyCodeObject *code) {
+            bytecode::Decoded decoded;
+            if (!bytecode::decode(code, decoded)) {
+                return nullptr;
+            }
+            std::unique_ptr<Liveness> liveness(new Liveness(code->co_nlocalsplus));
+            std::vector<Instruction> instrs(decoded.instrs.begin(), decoded.instrs.end());
+            for (Instruction &instr : instrs) {
+                find_accesses(instr);
+            }
+
+            int n_instrs = (int) instrs.size();
+            for (int i = 0; i < n_instrs; i++) {
+                Instruction &instr = instrs[i];
+                if (bytecode::falls_through(instr.opcode) && i + 1 < n_instrs) {
+                    instr.successor[instr.n_successor++] = i + 1;
+                }
+                int target = decoded.instr_at(bytecode::jump_target(instr));
+                if (target >= 0) {
+                    instr.successor[instr.n_successor++] = target;
+                }
+            }
+
+            for (const bytecode::ExceptionEntry &entry : bytecode::exception_entries(code)) {
+                int handler = decoded.instr_at(entry.target);
+                if (handler < 0) {
+                    continue;
+                }
+                for (uint32_t unit = entry.start; unit < entry.end; unit++) {
+                    int index = decoded.instr_at(unit);
+                    if (index >= 0 && instrs[index].offset == unit) {
+                        instrs[index].handler = handler;
+                    }
+                }
+            }
+
+            const uint8_t *kinds = (const uint8_t *) PyBytes_AS_STRING(code->co_localspluskinds);
+            size_t words = liveness->words;
+            std::vector<Word> tracked(words, 0);
+            for (const Instruction &instr : instrs) {
+                for (int a = 0; a < instr.n_access; a++) {
+                    int local = instr.access[a].local;
+                    if (local < liveness->nlocalsplus && !(kinds[local] & (FAST_CELL | FAST_FREE))) {
+                        tracked[local / WORD_BITS] |= Word(1) << (local % WORD_BITS);
+                    }
+                }
+            }
+
+            // Backward dataflow to a fixpoint. live_in holds one set per
+            // instruction; live_out is rebuilt from the successors.
+            std::vector<Word> live_in((size_t) n_instrs * words, 0);
+            std::vector<Word> out(words);
+            std::vector<Word> in(words);
+            auto compute_out = [&](int i) {
+                const Instruction &instr = instrs[i];
+                std::fill(out.begin(), out.end(), 0);
+                for (int s = 0; s < instr.n_successor; s++) {
+                    const Word *succ = &live_in[(size_t) instr.successor[s] * words];
+                    for (size_t w = 0; w < words; w++) out[w] |= succ[w];
+                }
+                // An exception can leave from anywhere in the instruction,
+                // including after the frame resumes in it.
+                if (instr.handler >= 0) {
+                    const Word *handler = &live_in[(size_t) instr.handler * words];
+                    for (size_t w = 0; w < words; w++) out[w] |= handler[w];
+                }
+            };
+            bool changed = true;
+            while (changed) {
+                changed = false;
+                for (int i = n_instrs - 1; i >= 0; i--) {
+                    const Instruction &instr = instrs[i];
+                    compute_out(i);
+                    in = out;
+                    for (int a = instr.n_access - 1; a >= 0; a--) {
+                        int local = instr.access[a].local;
+                        if (local >= liveness->nlocalsplus) {
+                            continue;
+                        }
+                        Word bit = Word(1) << (local % WORD_BITS);
+                        if (instr.access[a].write) {
+                            in[local / WORD_BITS] &= ~bit;
+                        } else {
+                            in[local / WORD_BITS] |= bit;
+                        }
+                    }
+                    if (instr.handler >= 0) {
+                        const Word *handler = &live_in[(size_t) instr.handler * words];
+                        for (size_t w = 0; w < words; w++) in[w] |= handler[w];
+                    }
+                    Word *slot = &live_in[(size_t) i * words];
+                    if (!std::equal(in.begin(), in.end(), slot)) {
+                        std::copy(in.begin(), in.end(), slot);
+                        changed = true;
+                    }
+                }
+            }
+
+            std::vector<Word> dead(words);
+            for (int i = 0; i < n_instrs; i++) {
+                compute_out(i);
+                for (size_t w = 0; w < words; w++) dead[w] = tracked[w] & ~out[w];
+                size_t runs = liveness->run_starts.size();
+                if (runs > 0 && liveness->set_equal(&liveness->run_dead[(runs - 1) * words], dead.data())) {
+                    continue;
+                }
+                liveness->run_starts.push_back(instrs[i].start);
+                liveness->run_dead.insert(liveness->run_dead.end(), dead.begin(), dead.end());
+            }
+            return liveness;
+        }
+
+        // Dead locals after the instruction at offset (in code units), or
+        // NULL if offset is before the first instruction.
+        const Word *dead_at(Py_ssize_t offset) const {
+            auto run = std::upper_bound(run_starts.begin(), run_starts.end(), (uint32_t) offset);
+            if (run == run_starts.begin()) {
+                return NULL;
+            }
+            return &run_dead[(size_t) (run - run_starts.begin() - 1) * words];
+        }
+
+        // Set the bits of the locals dead after the instruction at offset.
+        template <typename Bitmask>
+        void add_dead(Py_ssize_t offset, Bitmask &bitmask) const {
+            const Word *dead = dead_at(offset);
+            if (dead == NULL) {
+                return;
+            }
+            int n = std::min(nlocalsplus, (int) bitmask.size());
+            for (int local = 0; local < n; local++) {
+                if (dead[local / WORD_BITS] & (Word(1) << (local % WORD_BITS))) {
+                    bitmask[local] = true;
+                }
+            }
+        }
+    };
+}
+
+#endif // LIVENESS_HH_INCLUDED
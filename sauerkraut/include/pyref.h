@@ -115,6 +115,36 @@ class py_weakref {
     }
 };
 
+// Holds a buffer acquired with PyObject_GetBuffer and releases it
+// when it goes out of scope.
+class py_buffer {
+    Py_buffer view;
+    bool acquired = false;
+    public:
+    py_buffer() {}
+    py_buffer(const py_buffer &) = delete;
+    py_buffer &operator=(const py_buffer &) = delete;
+
+    ~py_buffer() {
+        if (acquired) {
+            PyBuffer_Release(&view);
+        }
+    }
+
+    bool acquire(PyObject *obj, int flags) {
+        acquired = (PyObject_GetBuffer(obj, &view, flags) == 0);
+        return acquired;
+    }
+
+    uint8_t *data() const {
+        return (uint8_t *) view.buf;
+    }
+
+    Py_ssize_t size() const {
+        return view.len;
+    }
+};
+
 using pyobject_strongref = py_strongref<PyObject>;
 using pyobject_weakref = py_weakref<PyObject>;
 using pycode_strongref = py_strongref<PyCodeObject>;
@@ -0,0 +1,88 @@
+#ifndef STACK_DEPTH_HH_INCLUDED
+#define STACK_DEPTH_HH_INCLUDED
+#include "sauerkraut_cpython_compat.h"
+#include <opcode_ids.h>
+#include "bytecode.h"
+#include <climits>
+#include <memory>
+#include <vector>
+
+namespace sauerkraut {
+    // The value stack depth of a frame stopped in each call of a code object.
+    //
+    // Computed once by following every path through the bytecode, including
+    // the paths into exception handlers, whose entry depth the exception
+    // table records. A resumed frame skips the call and its result, so the
+    // depth kept for a call is the one below its operands.
+    class StackDepths {
+        std::vector<int> depths;  // per code unit, -1 where unknown
+
+        public:
+        // Returns NULL with an exception set on failure.
+        static std::unique_ptr<StackDepths> analyze(PyCodeObject *code) {
+            bytecode::Decoded decoded;
+            if (!bytecode::decode(code, decoded)) {
+                return nullptr;
+            }
+            std::unique_ptr<StackDepths> result(new StackDepths());
+            result->depths.assign(decoded.unit_to_instr.size(), -1);
+
+            int n_instrs = (int) decoded.instrs.size();
+            std::vector<int> entry_depth(n_instrs, -1);
+            std::vector<int> worklist;
+            auto visit = [&](int index, int depth) {
+                if (index < 0 || depth < 0 || entry_depth[index] >= 0) {
+                    return;
+                }
+                entry_depth[index] = depth;
+                worklist.push_back(index);
+            };
+
+            visit(0, 0);
+            for (const bytecode::ExceptionEntry &entry : bytecode::exception_entries(code)) {
+                // The handler starts with the exception pushed, and with
+                // the offset of the raising instruction below it if lasti.
+                visit(decoded.instr_at(entry.target), entry.depth + entry.lasti + 1);
+            }
+
+            while (!worklist.empty()) {
+                int index = worklist.back();
+                worklist.pop_back();
+                const bytecode::Instruction &instr = decoded.instrs[index];
+                int depth = entry_depth[index];
+
+                if (instr.opcode == CALL) {
+                    result->depths[instr.offset] = depth - instr.oparg - 2;
+                } else if (instr.opcode == CALL_KW) {
+                    result->depths[instr.offset] = depth - instr.oparg - 3;
+                }
+
+                if (bytecode::falls_through(instr.opcode)) {
+                    int effect = PyCompile_OpcodeStackEffectWithJump(instr.opcode, instr.oparg, 0);
+                    if (effect != INT_MAX && index + 1 < n_instrs) {
+                        visit(index + 1, depth + effect);
+                    }
+                }
+                long target = bytecode::jump_target(instr);
+                if (target >= 0) {
+                    int effect = PyCompile_OpcodeStackEffectWithJump(instr.opcode, instr.oparg, 1);
+                    if (effect != INT_MAX) {
+                        visit(decoded.instr_at(target), depth + effect);
+                    }
+                }
+            }
+            return result;
+        }
+
+        // Depth below the operands of the call at offset (in code units),
+        // or -1 if there is no reachable call there.
+        int depth_at(Py_ssize_t offset) const {
+            if (offset < 0 || offset >= (Py_ssize_t) depths.size()) {
+                return -1;
+            }
+            return depths[offset];
+        }
+    };
+}
+
+#endif // STACK_DEPTH_HH_INCLUDED
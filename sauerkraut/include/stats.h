@@ -0,0 +1,150 @@
+#ifndef STATS_HH_INCLUDED
+#define STATS_HH_INCLUDED
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Counters and phase timers behind sauerkraut.stats(). They are always
+// compiled in; while disabled, each probe costs one predictable branch.
+// Everything is updated with the GIL held, so plain integers suffice.
+namespace sauerkraut::stats {
+    // Timers are inclusive: serialize includes the pickling it does.
+    enum Timer {
+        LIVENESS,
+        DEEPCOPY,
+        MODULE_SOURCE,
+        PICKLE,
+        UNPICKLE,
+        SERIALIZE,
+        DESERIALIZE,
+        N_TIMERS
+    };
+
+    enum Counter {
+        FRAMES_COPIED,
+        FRAMES_SERIALIZED,
+        FRAMES_DESERIALIZED,
+        OBJECTS_PICKLED,
+        OBJECTS_UNPICKLED,
+        // Bytes of finished frames, and of each part of them.
+        BYTES_FRAME,
+        BYTES_PICKLED,
+        BYTES_CODE,
+        BYTES_SHARED_OBJECTS,
+        BYTES_GLOBALS,
+        BYTES_LOCALS,
+        BYTES_STACK,
+        BYTES_MODULE,
+        LIVENESS_CACHE_HITS,
+        LIVENESS_CACHE_MISSES,
+        CODE_CACHE_HITS,
+        CODE_CACHE_MISSES,
+        N_COUNTERS
+    };
+
+    inline const char *timer_name(Timer timer) {
+        static const char *names[N_TIMERS] = {
+            "liveness", "deepcopy", "module_source", "pickle", "unpickle", "serialize", "deserialize",
+        };
+        return names[timer];
+    }
+
+    inline const char *counter_name(Counter counter) {
+        static const char *names[N_COUNTERS] = {
+            "frames_copied", "frames_serialized", "frames_deserialized",
+            "objects_pickled", "objects_unpickled",
+            "bytes_frame", "bytes_pickled", "bytes_code", "bytes_shared_objects",
+            "bytes_globals", "bytes_locals", "bytes_stack", "bytes_module",
+            "liveness_cache_hits", "liveness_cache_misses",
+            "code_cache_hits", "code_cache_misses",
+        };
+        return names[counter];
+    }
+
+    struct Stats {
+        bool enabled = false;
+        uint64_t timer_ns[N_TIMERS] = {};
+        uint64_t timer_calls[N_TIMERS] = {};
+        uint64_t counters[N_COUNTERS] = {};
+
+        void reset() {
+            for (int i = 0; i < N_TIMERS; i++) {
+                timer_ns[i] = 0;
+                timer_calls[i] = 0;
+            }
+            for (int i = 0; i < N_COUNTERS; i++) {
+                counters[i] = 0;
+            }
+        }
+    };
+
+    inline Stats &global() {
+        static Stats stats;
+        return stats;
+    }
+
+    inline bool enabled() {
+        return global().enabled;
+    }
+
+    inline void add(Counter counter, uint64_t n = 1) {
+        if (enabled()) {
+            global().counters[counter] += n;
+        }
+    }
+
+    inline uint64_t now_ns() {
+        return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Adds the time until the end of the scope to a timer.
+    class ScopedTimer {
+        Timer timer;
+        bool running;
+        uint64_t start = 0;
+
+        public:
+        explicit ScopedTimer(Timer timer) : timer(timer), running(enabled()) {
+            if (running) {
+                start = now_ns();
+            }
+        }
+
+        ~ScopedTimer() {
+            if (running) {
+                Stats &stats = global();
+                stats.timer_ns[timer] += now_ns() - start;
+                stats.timer_calls[timer]++;
+            }
+        }
+
+        ScopedTimer(const ScopedTimer &) = delete;
+        ScopedTimer &operator=(const ScopedTimer &) = delete;
+    };
+
+    // Attributes what a FlatBufferBuilder grew by to one byte counter at a time.
+    template <typename Builder>
+    class SectionBytes {
+        Builder &builder;
+        size_t last = 0;
+
+        public:
+        explicit SectionBytes(Builder &builder) : builder(builder) {
+            if (enabled()) {
+                last = builder.GetSize();
+            }
+        }
+
+        // Count the bytes added since the last call as counter.
+        void add(Counter counter) {
+            if (enabled()) {
+                size_t size = builder.GetSize();
+                global().counters[counter] += size - last;
+                last = size;
+            }
+        }
+    };
+}
+
+#endif
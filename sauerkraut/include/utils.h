@@ -10,6 +10,8 @@
 
 #include "py_structs.h"
 #include "pyref.h"
+#include "code_info.h"
+#include "frame_allocator.h"
 
 namespace {
 
@@ -320,6 +322,10 @@ namespace utils {
            return false;
        }
 
+       inline intptr_t stackref_untag_int(_PyStackRef) {
+           return 0;
+       }
+
        inline PyObject *stackref_as_pyobject(_PyStackRef ref) {
            return (PyObject *) ref.bits;
        }
@@ -415,9 +421,13 @@ namespace utils {
         char get_current_opcode(py_weakref<struct _frame> frame) {
             return frame->f_frame->instr_ptr->opcode;
         }
-        char get_current_opcode(pycode_weakref code, int offset) {
-            pyobject_strongref code_bytes = pyobject_strongref::steal(PyCode_GetCode(code.borrow()));
-            char *bitcode = PyBytes_AsString(code_bytes.borrow());
+        // Returns -1 with an exception set if the bytecode cannot be read.
+        int get_current_opcode(pycode_weakref code, int offset) {
+            PyObject *code_bytes = sauerkraut::get_deopt_code(code.borrow());
+            if (code_bytes == NULL) {
+                return -1;
+            }
+            char *bitcode = PyBytes_AS_STRING(code_bytes);
             return ((sauerkraut::PyBitcodeInstruction*) (bitcode + offset))->opcode;
         }
 
@@ -448,15 +458,20 @@ namespace utils {
             return (_PyInterpreterFrame*) push_chunk(*tstate, size);
         }
 
+        // A frame of size words that is not on a thread's data stack.
+        // Release it with FreeFrame.
         _PyInterpreterFrame *AllocateFrame(size_t size) {
-            return (_PyInterpreterFrame*) malloc(size * sizeof(PyObject*));
+            return (_PyInterpreterFrame*) sauerkraut::FrameAllocator::instance().allocate(size * sizeof(PyObject*));
+        }
+        void FreeFrame(_PyInterpreterFrame *frame) {
+            sauerkraut::FrameAllocator::instance().free(frame);
         }
         _PyInterpreterFrame *AllocateFrame(py_weakref<PyThreadState> tstate, size_t size) {
             return (_PyInterpreterFrame*) ThreadState_PushFrame(*tstate, size);
         }
 
         // TODO: This should use units
-        Py_ssize_t get_offset_for_skipping_call(char opcode) {
+        Py_ssize_t get_offset_for_skipping_call(int opcode) {
             // return 2 * sizeof(_CodeUnit);
             #if SAUERKRAUT_PY314
             return 5 * sizeof(_CodeUnit);
@@ -532,10 +547,16 @@ namespace utils {
             return n_instructions * sizeof(_CodeUnit);
         }
 
+        // Returns -1 with an exception set, leaving the frame as it was, if
+        // the bytecode cannot be read.
         Py_ssize_t skip_current_call_instruction(py_weakref<PyFrameObject> frame) {
             pycode_strongref code = pycode_strongref::steal(PyFrame_GetCode(*frame));
             Py_ssize_t base_offset = get_instr_offset<Units::Bytes>(*frame);
-            Py_ssize_t offset = get_instr_offset<Units::Bytes>(*frame) + get_offset_for_skipping_call(get_current_opcode(code, base_offset));
+            int opcode = get_current_opcode(code, base_offset);
+            if (opcode < 0) {
+                return -1;
+            }
+            Py_ssize_t offset = base_offset + get_offset_for_skipping_call(opcode);
             frame->f_frame->instr_ptr = (_CodeUnit*) (code->co_code_adaptive + offset);
             return offset;
         }
@@ -559,22 +580,17 @@ namespace utils {
             #endif
         }
 
-        Py_ssize_t get_stack_depth(PyObject *frame) {
-            // we must analyze the code to determine the current stack depth.
-            // iframe->stackpointer is rarely written to (e.g., with generators).
-            // Therefore, we have to determine the stack depth by looking backwards
-            // at the compiled bitcode.
-            // TODO: This ignores the following constructs which affect the stack depth:
-            // 1. Try/except blocks; 2. Calls.
-            // We consider only loops.
-            // sauerkraut::PyCodeObject *code = (sauerkraut::PyCodeObject*) iframe->f_executable.bits;
-            sauerkraut::PyFrame *py_frame = (sauerkraut::PyFrame*) frame;
-            pycode_strongref code = pycode_strongref::steal(PyFrame_GetCode((PyFrameObject*)py_frame));
-
-            // divide by 2 to convert from bytes to instructions
-            Py_ssize_t offset = get_instr_offset<Units::Instructions>(py_frame->f_frame);
-            pyobject_strongref code_bytes = pyobject_strongref::steal(PyCode_GetCode(code.borrow()));
-            char *bitcode = PyBytes_AsString(code_bytes.borrow());
+        // Counts the for loops around the frame's instruction: each keeps its
+        // iterator on the stack. Other constructs that leave values on the
+        // stack (with blocks, exception handlers, pending operands) are not
+        // seen, so this only backs up the precomputed depths.
+        static Py_ssize_t scan_stack_depth(PyCodeObject *code, Py_ssize_t offset) {
+            PyObject *code_bytes = sauerkraut::get_deopt_code(code);
+            if (code_bytes == NULL) {
+                PyErr_Clear();
+                return 0;
+            }
+            char *bitcode = PyBytes_AS_STRING(code_bytes);
             sauerkraut::PyBitcodeInstruction *first_instr = (sauerkraut::PyBitcodeInstruction*) bitcode;
             sauerkraut::PyBitcodeInstruction *instr = (sauerkraut::PyBitcodeInstruction*) first_instr + offset;
 
@@ -596,6 +612,27 @@ namespace utils {
             return num_for - num_end;
         }
 
+        Py_ssize_t get_stack_depth(PyObject *frame) {
+            // iframe->stackpointer is rarely written to (e.g., with generators),
+            // so the depth comes from an analysis of the code, done once per
+            // code object. It is the depth below the operands of the call
+            // the frame is stopped in.
+            sauerkraut::PyFrame *py_frame = (sauerkraut::PyFrame*) frame;
+            pycode_strongref code = pycode_strongref::steal(PyFrame_GetCode((PyFrameObject*)py_frame));
+
+            Py_ssize_t offset = get_instr_offset<Units::Instructions>(py_frame->f_frame);
+            const sauerkraut::StackDepths *depths = sauerkraut::get_stack_depths(code.borrow());
+            if (depths == NULL) {
+                PyErr_Clear();
+            } else {
+                int depth = depths->depth_at(offset);
+                if (depth >= 0) {
+                    return depth;
+                }
+            }
+            return scan_stack_depth(code.borrow(), offset);
+        }
+
         _PyStackRef *get_stack_base(sauerkraut::PyInterpreterFrame *f) {
             return f->localsplus + ((PyCodeObject*)stackref_as_pyobject(f->f_executable))->co_nlocalsplus;
         }
@@ -668,37 +705,29 @@ namespace utils {
             return state;
         }
 
-        using LocalNameMap = std::map<std::string, int>;
         using LocalExclusionBitmask = std::vector<bool>;
 
-        LocalNameMap get_local_name_map(py_weakref<PyFrameObject> frame) {
-            _PyInterpreterFrame *iframe = (_PyInterpreterFrame*) frame->f_frame;
-            pycode_strongref code = pycode_strongref::steal(PyFrame_GetCode((PyFrameObject*)*frame));
-            // this is a tuple of the names of the localsplus
-            PyObject *locals_plus_names = code->co_localsplusnames;
-            LocalNameMap local_idx_map;
-
-            for(int i = 0; i < code->co_nlocalsplus; i++) {
-                PyObject *local = stackref_as_pyobject(iframe->localsplus[i]);
-                std::string name = PyUnicode_AsUTF8(PyTuple_GetItem(locals_plus_names, i));
-                local_idx_map[name] = i;
-            }
-            return local_idx_map;
-        }
-
-        LocalExclusionBitmask exclude_locals(py_weakref<PyFrameObject> frame, PyObject *exclude_locals) {
-            _PyInterpreterFrame *iframe = (_PyInterpreterFrame*) frame->f_frame;
-            pycode_strongref code = pycode_strongref::steal(PyFrame_GetCode(*frame));
-            LocalExclusionBitmask bitmask(code->co_nlocalsplus);
-            LocalNameMap local_idx_map = get_local_name_map(frame);
-
-            PyIterable locals_to_exclude(exclude_locals);
-            for(auto local : locals_to_exclude) {
+        // Mark the locals of code named (or indexed) by the items of
+        // exclude_locals. Returns false with an exception set on failure.
+        bool exclude_locals(PyCodeObject *code, PyObject *exclude_locals, LocalExclusionBitmask &bitmask) {
+            const sauerkraut::LocalNameIndex *local_names = sauerkraut::get_local_names(code);
+            if (local_names == NULL) {
+                return false;
+            }
+            pyobject_strongref iter = pyobject_strongref::steal(PyObject_GetIter(exclude_locals));
+            if (!iter) {
+                PyErr_SetString(PyExc_TypeError, "exclude_locals must be a set-like object");
+                return false;
+            }
+            while (true) {
+                pyobject_strongref local = pyobject_strongref::steal(PyIter_Next(iter.borrow()));
+                if (!local) {
+                    return !PyErr_Occurred();
+                }
                 if(PyUnicode_Check(*local)) {
-                    std::string local_name = PyUnicode_AsUTF8(*local);
-                    auto it = local_idx_map.find(local_name);
-                    if(it != local_idx_map.end()) {
-                        bitmask[it->second] = true;
+                    int local_idx = local_names->find(*local);
+                    if(local_idx >= 0) {
+                        bitmask[local_idx] = true;
                     }
                 } else if(PyLong_Check(*local)) {
                     int local_idx = PyLong_AsLong(*local);
@@ -706,24 +735,26 @@ namespace utils {
                         bitmask[local_idx] = true;
                     } else {
                         PyErr_SetString(PyExc_IndexError, "exclude_locals index out of range");
-                        return LocalExclusionBitmask();
+                        return false;
                     }
                 } else {
                     PyErr_SetString(PyExc_TypeError, "exclude_locals must be an iterable of strings or integers");
-                    return LocalExclusionBitmask();
+                    return false;
                 }
             }
-            return bitmask;
         }
 
-        void replace_locals(py_weakref<PyFrameObject> frame, PyObject *replace_locals) {
-            _PyInterpreterFrame *iframe = (_PyInterpreterFrame*) frame->f_frame;
-            LocalNameMap local_idx_map = get_local_name_map(frame);
-            pycode_strongref code = pycode_strongref::steal(PyFrame_GetCode((PyFrameObject*)*frame));
-
+        // Resolve the keys of replace_locals, names or indices, to slots of
+        // code. Names that code does not have are skipped.
+        bool resolve_replace_locals(PyCodeObject *code, PyObject *replace_locals,
+                                    std::vector<std::pair<int, PyObject*>> &slots) {
             if(!PyDict_Check(replace_locals)) {
                 PyErr_SetString(PyExc_TypeError, "replace_locals must be a dictionary");
-                return;
+                return false;
+            }
+            const sauerkraut::LocalNameIndex *local_names = sauerkraut::get_local_names(code);
+            if (local_names == NULL) {
+                return false;
             }
 
             PyObject *key, *value;
@@ -734,31 +765,42 @@ namespace utils {
                 
                 if (PyUnicode_Check(key)) {
                     // Handle string keys (variable names)
-                    std::string name = PyUnicode_AsUTF8(key);
-                    auto it = local_idx_map.find(name);
-                    if (it != local_idx_map.end()) {
-                        local_index = it->second;
-                    }
+                    local_index = local_names->find(key);
                 } else if (PyLong_Check(key)) {
                     // Handle integer keys (direct indices)
                     local_index = PyLong_AsLong(key);
                     if (local_index < 0 || local_index >= code->co_nlocalsplus) {
                         PyErr_SetString(PyExc_IndexError, "replace_locals index out of range");
-                        return;
+                        return false;
                     }
                 } else {
                     PyErr_SetString(PyExc_TypeError, "replace_locals key must be a string or integer");
-                    return;
+                    return false;
                 }
                 
                 if (local_index >= 0) {
-                    _PyStackRef old_ref = iframe->localsplus[local_index];
-                    iframe->localsplus[local_index] = stackref_from_pyobject_new(value);
-
-                    // Decrement reference count of old value
-                    stackref_decref(old_ref);
+                    slots.emplace_back(local_index, value);
                 }
             }
+            return true;
+        }
+
+        // Nothing is replaced unless every key resolves.
+        void replace_locals(py_weakref<PyFrameObject> frame, PyObject *replace_locals) {
+            _PyInterpreterFrame *iframe = (_PyInterpreterFrame*) frame->f_frame;
+            pycode_strongref code = pycode_strongref::steal(PyFrame_GetCode((PyFrameObject*)*frame));
+            std::vector<std::pair<int, PyObject*>> slots;
+            if (!resolve_replace_locals(code.borrow(), replace_locals, slots)) {
+                return;
+            }
+
+            for (auto [local_index, value] : slots) {
+                _PyStackRef old_ref = iframe->localsplus[local_index];
+                iframe->localsplus[local_index] = stackref_from_pyobject_new(value);
+
+                // Decrement reference count of old value
+                stackref_decref(old_ref);
+            }
         }
     }
 }
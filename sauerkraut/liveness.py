@@ -1,5 +1,6 @@
 from typing import Dict, Set, List, Tuple, Union
 import types
+import weakref
 import bytecode as bc
 from bytecode import Instr, BasicBlock, ControlFlowGraph, Bytecode
 
@@ -235,12 +236,15 @@ class LivenessAnalysis:
         return self._instr_offsets
 
 
-liveness_cache = {}
+# Code objects compare by content, so equal code shares one analysis while
+# functions that merely share a name do not. Entries go away with the code.
+liveness_cache = weakref.WeakKeyDictionary()
 
 
 def get_dead_variables_at_offset(code: types.CodeType, offset: int) -> Set[str]:
     """Get the set of dead variables at a given bytecode offset."""
-    h = hash(code.co_name)
-    if h not in liveness_cache:
-        liveness_cache[h] = LivenessAnalysis(code)
-    return liveness_cache[h].get_dead_variables_at_offset(offset)
+    analysis = liveness_cache.get(code)
+    if analysis is None:
+        analysis = LivenessAnalysis(code)
+        liveness_cache[code] = analysis
+    return analysis.get_dead_variables_at_offset(offset)
@@ -0,0 +1,128 @@
+"""A code registry shared between processes through the file system.
+
+Frames serialized with ``exclude_immutables=True`` leave out their code
+object and identify it by its content hash (``code_hash``).  Within one
+process the code is found in sauerkraut's in-memory cache; a registry makes
+it available to every process that points at the same directory, so the
+smaller frames can travel between workers on a node or a shared file
+system:
+
+    registry = CodeRegistry("/shared/sauerkraut-code")
+    set_code_registry(registry)
+
+The sender publishes each code object the first time one of its frames is
+serialized with ``exclude_immutables=True``.  A receiver that meets an
+unknown hash maps the entry, imports the module the function came from and
+uses the function found there under its qualified name if its code has the
+same hash.  Otherwise a new function is built from the stored code, with
+the module's globals when the module can be imported.
+
+Each entry is one file named after the hash:
+
+    MAGIC | marshal((module, qualname, code))
+
+Entries are written to a temporary file and renamed into place, so readers
+never see a partial entry and concurrent writers of the same code are
+harmless.
+"""
+
+import builtins
+import importlib
+import marshal
+import mmap
+import os
+import sys
+import tempfile
+import types
+
+from ._sauerkraut import code_hash
+
+MAGIC = b"SKCODE01"
+
+_SUFFIX = ".code"
+
+
+class CodeRegistry:
+    def __init__(self, path):
+        """Use the registry in directory ``path``, creating it if needed."""
+        self.path = os.fspath(path)
+        os.makedirs(self.path, exist_ok=True)
+        # Functions handed out by resolve; the in-memory cache only holds
+        # weak references to them.
+        self._resolved = {}
+
+    def _entry_path(self, hash_str):
+        return os.path.join(self.path, hash_str + _SUFFIX)
+
+    def publish(self, hash_str, code, function):
+        """Store ``code``, which ``function`` runs, under ``hash_str``."""
+        path = self._entry_path(hash_str)
+        if os.path.exists(path):
+            return
+        payload = marshal.dumps((function.__module__, function.__qualname__, code))
+        fd, tmp_path = tempfile.mkstemp(dir=self.path, suffix=".tmp")
+        try:
+            with os.fdopen(fd, "wb") as f:
+                f.write(MAGIC)
+                f.write(payload)
+            os.replace(tmp_path, path)
+        except BaseException:
+            try:
+                os.unlink(tmp_path)
+            except FileNotFoundError:
+                pass
+            raise
+
+    def resolve(self, hash_str):
+        """The function whose code hashes to ``hash_str``, or ``None``."""
+        function = self._resolved.get(hash_str)
+        if function is not None:
+            return function
+        try:
+            with open(self._entry_path(hash_str), "rb") as f:
+                with mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ) as view:
+                    if view[: len(MAGIC)] != MAGIC:
+                        raise ValueError(f"{f.name} is not a sauerkraut code registry entry")
+                    module_name, qualname, code = marshal.loads(view[len(MAGIC) :])
+        except FileNotFoundError:
+            return None
+
+        module = _import(module_name)
+        function = _lookup(module, qualname)
+        if function is None or code_hash(function) != hash_str:
+            function = _make_function(code, module, module_name)
+        self._resolved[hash_str] = function
+        return function
+
+
+def _import(module_name):
+    if module_name is None:
+        return None
+    module = sys.modules.get(module_name)
+    if module is not None:
+        return module
+    try:
+        return importlib.import_module(module_name)
+    except ImportError:
+        return None
+
+
+def _lookup(module, qualname):
+    """The function at ``qualname`` in ``module``; None for nested functions."""
+    if module is None or "<locals>" in qualname:
+        return None
+    obj = module
+    for part in qualname.split("."):
+        obj = getattr(obj, part, None)
+        if obj is None:
+            return None
+    return obj if isinstance(obj, types.FunctionType) else None
+
+
+def _make_function(code, module, module_name):
+    if module is not None:
+        globals_ = module.__dict__
+    else:
+        globals_ = {"__name__": module_name, "__builtins__": builtins}
+    closure = tuple(types.CellType() for _ in code.co_freevars) or None
+    return types.FunctionType(code, globals_, code.co_name, None, closure)
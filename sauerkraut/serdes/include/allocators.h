@@ -0,0 +1,155 @@
+#ifndef ALLOCATORS_HH_INCLUDED
+#define ALLOCATORS_HH_INCLUDED
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include "flatbuffers/flatbuffers.h"
+
+namespace serdes {
+    // Lets a FlatBufferBuilder build into memory owned by the caller.
+    // The builder writes back-to-front, so the finished buffer ends at the
+    // tail of the region. If the frame needs more room than the region has,
+    // the builder is given heap memory instead and overflowed() reports it;
+    // the caller decides whether that is an error.
+    class FixedBufferAllocator : public flatbuffers::Allocator {
+        // FlatBuffers aligns relative to the end of its buffer.
+        static constexpr uintptr_t ALIGNMENT = 8;
+
+        uint8_t *region = nullptr;
+        size_t region_size = 0;
+        bool region_in_use = false;
+        bool overflow = false;
+
+        public:
+        FixedBufferAllocator(uint8_t *data, size_t size) {
+            uintptr_t begin = reinterpret_cast<uintptr_t>(data);
+            uintptr_t end = (begin + size) & ~(ALIGNMENT - 1);
+            if(end > begin) {
+                region_size = (end - begin) & ~(ALIGNMENT - 1);
+                region = reinterpret_cast<uint8_t *>(end - region_size);
+            }
+        }
+
+        // Usable bytes; pass this as the builder's initial size so the
+        // first allocation is satisfied by the region.
+        size_t capacity() const {
+            return region_size;
+        }
+
+        bool overflowed() const {
+            return overflow;
+        }
+
+        uint8_t *allocate(size_t size) override {
+            if(!region_in_use && size <= region_size) {
+                region_in_use = true;
+                return region;
+            }
+            overflow = true;
+            return new uint8_t[size];
+        }
+
+        void deallocate(uint8_t *p, size_t) override {
+            if(p == region) {
+                region_in_use = false;
+                return;
+            }
+            delete[] p;
+        }
+    };
+
+    // Recycles builder memory across serializations. Finished frames are
+    // handed to Python without a copy, so a builder cannot keep its buffer;
+    // instead, when a frame is freed its block returns here and the next
+    // builder starts out in it. All calls happen with the GIL held, which
+    // is what serializes access to the free list.
+    class PooledAllocator : public flatbuffers::Allocator {
+        static constexpr size_t MAX_BLOCKS = 8;
+        static constexpr size_t MAX_CACHED_BYTES = 64 << 20;
+
+        struct Block {
+            uint8_t *data;
+            size_t size;
+        };
+        std::vector<Block> blocks;
+        size_t cached_bytes = 0;
+
+        PooledAllocator() = default;
+
+        public:
+        PooledAllocator(const PooledAllocator &) = delete;
+        PooledAllocator &operator=(const PooledAllocator &) = delete;
+
+        // Never destroyed: frames may outlive every other static object.
+        static PooledAllocator &instance() {
+            static PooledAllocator *allocator = new PooledAllocator();
+            return *allocator;
+        }
+
+        uint8_t *allocate(size_t size) override {
+            // The smallest cached block that fits, as long as it is not so
+            // big that a small frame would pin a lot of memory.
+            size_t best = blocks.size();
+            for (size_t i = 0; i < blocks.size(); i++) {
+                if (blocks[i].size >= size && blocks[i].size <= 2 * size &&
+                    (best == blocks.size() || blocks[i].size < blocks[best].size)) {
+                    best = i;
+                }
+            }
+            if (best == blocks.size()) {
+                return new uint8_t[size];
+            }
+            uint8_t *data = blocks[best].data;
+            cached_bytes -= blocks[best].size;
+            blocks[best] = blocks.back();
+            blocks.pop_back();
+            return data;
+        }
+
+        // size is what the builder asked for, which may be less than the
+        // block it got; the pool only uses it to bound what it keeps.
+        void deallocate(uint8_t *p, size_t size) override {
+            if (blocks.size() >= MAX_BLOCKS || cached_bytes + size > MAX_CACHED_BYTES) {
+                delete[] p;
+                return;
+            }
+            blocks.push_back({p, size});
+            cached_bytes += size;
+        }
+    };
+
+    // Block-aligned builder memory. A builder created with buffer_minalign
+    // BLOCK_ALIGNMENT keeps its buffer a whole number of blocks long, so
+    // with this allocator the buffer also ends on a block boundary.
+    constexpr size_t BLOCK_ALIGNMENT = 4096;
+
+    class BlockAlignedAllocator : public flatbuffers::Allocator {
+        BlockAlignedAllocator() = default;
+
+        public:
+        BlockAlignedAllocator(const BlockAlignedAllocator &) = delete;
+        BlockAlignedAllocator &operator=(const BlockAlignedAllocator &) = delete;
+
+        // Never destroyed: frames may outlive every other static object.
+        static BlockAlignedAllocator &instance() {
+            static BlockAlignedAllocator *allocator = new BlockAlignedAllocator();
+            return *allocator;
+        }
+
+        uint8_t *allocate(size_t size) override {
+            void *data = nullptr;
+            if (posix_memalign(&data, BLOCK_ALIGNMENT, size) != 0) {
+                throw std::bad_alloc();
+            }
+            return static_cast<uint8_t *>(data);
+        }
+
+        void deallocate(uint8_t *p, size_t) override {
+            std::free(p);
+        }
+    };
+}
+
+#endif // ALLOCATORS_HH_INCLUDED
@@ -0,0 +1,171 @@
+#ifndef COMPRESSION_HH_INCLUDED
+#define COMPRESSION_HH_INCLUDED
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+#include "py_object_generated.h"
+
+#ifdef SAUERKRAUT_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef SAUERKRAUT_HAVE_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+#ifdef SAUERKRAUT_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+// Codecs for object payloads. Which ones exist depends on the libraries
+// found at build time; Codec_Uncompressed is always available.
+namespace serdes::compression {
+    using Codec = pyframe_buffer::Codec;
+
+    // Outside every codec's range; zstd's fast levels are negative.
+    constexpr int DEFAULT_LEVEL = INT_MIN;
+    constexpr size_t DEFAULT_THRESHOLD = 4096;
+
+    struct Settings {
+        Codec codec = pyframe_buffer::Codec_Uncompressed;
+        // DEFAULT_LEVEL picks the codec's own default.
+        int level = DEFAULT_LEVEL;
+        // Payloads smaller than this are stored as-is.
+        size_t threshold = DEFAULT_THRESHOLD;
+
+        bool enabled() const {
+            return codec != pyframe_buffer::Codec_Uncompressed;
+        }
+    };
+
+    inline bool available(Codec codec) {
+        switch (codec) {
+            case pyframe_buffer::Codec_Uncompressed:
+                return true;
+#ifdef SAUERKRAUT_HAVE_ZLIB
+            case pyframe_buffer::Codec_Zlib:
+                return true;
+#endif
+#ifdef SAUERKRAUT_HAVE_LZ4
+            case pyframe_buffer::Codec_LZ4:
+                return true;
+#endif
+#ifdef SAUERKRAUT_HAVE_ZSTD
+            case pyframe_buffer::Codec_Zstd:
+                return true;
+#endif
+            default:
+                return false;
+        }
+    }
+
+    inline const char *codec_name(Codec codec) {
+        switch (codec) {
+            case pyframe_buffer::Codec_Uncompressed:
+                return "none";
+            case pyframe_buffer::Codec_Zlib:
+                return "zlib";
+            case pyframe_buffer::Codec_LZ4:
+                return "lz4";
+            case pyframe_buffer::Codec_Zstd:
+                return "zstd";
+            default:
+                return "unknown";
+        }
+    }
+
+    inline std::optional<Codec> codec_from_name(const std::string &name) {
+        for (auto codec : {pyframe_buffer::Codec_Uncompressed, pyframe_buffer::Codec_Zlib,
+                           pyframe_buffer::Codec_LZ4, pyframe_buffer::Codec_Zstd}) {
+            if (name == codec_name(codec)) {
+                return codec;
+            }
+        }
+        return std::nullopt;
+    }
+
+    // Compress src into out. Returns false if the codec is unavailable or
+    // fails; callers then store the payload uncompressed.
+    inline bool compress(const Settings &settings, const uint8_t *src, size_t size, std::vector<uint8_t> &out) {
+        switch (settings.codec) {
+#ifdef SAUERKRAUT_HAVE_ZLIB
+            case pyframe_buffer::Codec_Zlib: {
+                uLongf out_size = compressBound(size);
+                out.resize(out_size);
+                int level = (settings.level == DEFAULT_LEVEL) ? Z_DEFAULT_COMPRESSION : settings.level;
+                if (compress2(out.data(), &out_size, src, size, level) != Z_OK) {
+                    return false;
+                }
+                out.resize(out_size);
+                return true;
+            }
+#endif
+#ifdef SAUERKRAUT_HAVE_LZ4
+            case pyframe_buffer::Codec_LZ4: {
+                if (size > (size_t) LZ4_MAX_INPUT_SIZE) {
+                    return false;
+                }
+                out.resize(LZ4_compressBound((int) size));
+                int out_size;
+                if (settings.level == DEFAULT_LEVEL || settings.level <= 1) {
+                    out_size = LZ4_compress_default((const char *) src, (char *) out.data(), (int) size, (int) out.size());
+                } else {
+                    out_size = LZ4_compress_HC((const char *) src, (char *) out.data(), (int) size, (int) out.size(), settings.level);
+                }
+                if (out_size <= 0) {
+                    return false;
+                }
+                out.resize(out_size);
+                return true;
+            }
+#endif
+#ifdef SAUERKRAUT_HAVE_ZSTD
+            case pyframe_buffer::Codec_Zstd: {
+                out.resize(ZSTD_compressBound(size));
+                int level = (settings.level == DEFAULT_LEVEL) ? ZSTD_CLEVEL_DEFAULT : settings.level;
+                size_t out_size = ZSTD_compress(out.data(), out.size(), src, size, level);
+                if (ZSTD_isError(out_size)) {
+                    return false;
+                }
+                out.resize(out_size);
+                return true;
+            }
+#endif
+            default:
+                return false;
+        }
+    }
+
+    // Decompress exactly raw_size bytes into dst.
+    inline bool decompress(Codec codec, const uint8_t *src, size_t size, uint8_t *dst, size_t raw_size) {
+        switch (codec) {
+#ifdef SAUERKRAUT_HAVE_ZLIB
+            case pyframe_buffer::Codec_Zlib: {
+                uLongf out_size = raw_size;
+                return uncompress(dst, &out_size, src, size) == Z_OK && out_size == raw_size;
+            }
+#endif
+#ifdef SAUERKRAUT_HAVE_LZ4
+            case pyframe_buffer::Codec_LZ4: {
+                if (raw_size > (size_t) LZ4_MAX_INPUT_SIZE) {
+                    return false;
+                }
+                int out_size = LZ4_decompress_safe((const char *) src, (char *) dst, (int) size, (int) raw_size);
+                return out_size >= 0 && (size_t) out_size == raw_size;
+            }
+#endif
+#ifdef SAUERKRAUT_HAVE_ZSTD
+            case pyframe_buffer::Codec_Zstd: {
+                size_t out_size = ZSTD_decompress(dst, raw_size, src, size);
+                return !ZSTD_isError(out_size) && out_size == raw_size;
+            }
+#endif
+            default:
+                return false;
+        }
+    }
+}
+
+#endif // COMPRESSION_HH_INCLUDED
@@ -13,25 +13,103 @@
 #include "pyref.h"
 #include "py_structs.h"
 #include "utils.h"
+#include "compression.h"
+#include "hash.h"
+#include "code_info.h"
+#include "stats.h"
 #include <optional>
+#include <random>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace serdes {
     constexpr int SERIALIZATION_SIZEHINT_DEFAULT = 1024;
+
+    // The serialized local in each slot of frame, or NULL where the local
+    // was excluded.
+    inline std::vector<const pyframe_buffer::PyObject*> local_slots(const pyframe_buffer::PyInterpreterFrame *frame) {
+        std::vector<const pyframe_buffer::PyObject*> slots;
+        if (frame == NULL) {
+            return slots;
+        }
+        auto localsplus = frame->locals_plus();
+        auto exclusion_bitmask = frame->locals_exclusion_bitmask();
+        if (localsplus == NULL || exclusion_bitmask == NULL) {
+            return slots;
+        }
+        slots.reserve(exclusion_bitmask->size());
+        flatbuffers::uoffset_t localsplus_idx = 0;
+        for (flatbuffers::uoffset_t i = 0; i < exclusion_bitmask->size(); i++) {
+            if (exclusion_bitmask->Get(i) != 0 || localsplus_idx >= localsplus->size()) {
+                slots.push_back(NULL);
+            } else {
+                slots.push_back(localsplus->Get(localsplus_idx++));
+            }
+        }
+        return slots;
+    }
+
+    // What a delta needs to know about the frame it is taken against.
+    struct DeltaBase {
+        uint64_t checkpoint_id = 0;
+        // Content hash of each local, 0 where none was recorded.
+        std::vector<uint64_t> local_hashes;
+    };
+
+    // std::nullopt unless frame was serialized with incremental=True.
+    inline std::optional<DeltaBase> read_delta_base(const pyframe_buffer::PyFrame *frame) {
+        if (frame->checkpoint_id() == 0 || frame->f_frame() == NULL) {
+            return std::nullopt;
+        }
+        DeltaBase base;
+        base.checkpoint_id = frame->checkpoint_id();
+        for (auto slot : local_slots(frame->f_frame())) {
+            base.local_hashes.push_back(slot != NULL ? slot->content_hash() : 0);
+        }
+        return base;
+    }
+
+    inline uint64_t new_checkpoint_id() {
+        thread_local std::mt19937_64 generator{std::random_device{}()};
+        uint64_t id;
+        do {
+            id = generator();
+        } while (id == 0);
+        return id;
+    }
+
+    struct BatchContext;
+
     class SerializationArgs {
         public:
         std::optional<utils::py::LocalExclusionBitmask> exclude_locals;
         bool exclude_immutables = false;
         bool capture_module_source = false;
+        bool out_of_band = false;
+        compression::Settings compression;
+        // Serialize every local on its own and record content hashes, so the
+        // frame can be the base of a later delta.
+        bool incremental = false;
+        std::optional<DeltaBase> delta_base;
+        // Pad the finished frame to whole blocks of BLOCK_ALIGNMENT bytes,
+        // starting on a block boundary, for files opened with O_DIRECT.
+        bool aligned = false;
+        // Set while the frame is serialized as part of a batch.
+        BatchContext *batch = nullptr;
         size_t sizehint;
+        // Whether sizehint came from the caller. If not, the size learned
+        // from earlier frames of the same code is used instead.
+        bool sizehint_given = false;
         std::optional<std::string> module_name;
         std::optional<std::string> module_package;
         std::optional<std::string> module_filename;
         std::optional<std::vector<uint8_t>> module_source;
 
         SerializationArgs(std::optional<utils::py::LocalExclusionBitmask> exclude_locals, bool exclude_immutables, bool capture_module_source, size_t sizehint) :
-            exclude_locals(exclude_locals), exclude_immutables(exclude_immutables), capture_module_source(capture_module_source), sizehint(sizehint) {}
+            exclude_locals(exclude_locals), exclude_immutables(exclude_immutables), capture_module_source(capture_module_source), sizehint(sizehint), sizehint_given(true) {}
         SerializationArgs() : exclude_locals(std::nullopt), exclude_immutables(false), capture_module_source(false), sizehint(SERIALIZATION_SIZEHINT_DEFAULT) {}
-        SerializationArgs(size_t sizehint) : exclude_locals(std::nullopt), exclude_immutables(false), capture_module_source(false), sizehint(sizehint) {}
+        SerializationArgs(size_t sizehint) : exclude_locals(std::nullopt), exclude_immutables(false), capture_module_source(false), sizehint(sizehint), sizehint_given(true) {}
 
         void set_exclude_locals(std::optional<utils::py::LocalExclusionBitmask> exclude_locals) {
             this->exclude_locals = exclude_locals;
@@ -45,8 +123,40 @@ namespace serdes {
             this->capture_module_source = capture_module_source;
         }
 
+        void set_out_of_band(bool out_of_band) {
+            this->out_of_band = out_of_band;
+        }
+
+        void set_compression(compression::Settings compression) {
+            this->compression = compression;
+        }
+
+        void set_batch(BatchContext *batch) {
+            this->batch = batch;
+        }
+
+        void set_incremental(bool incremental) {
+            this->incremental = incremental;
+        }
+
+        void set_aligned(bool aligned) {
+            this->aligned = aligned;
+        }
+
+        void set_delta_base(std::optional<DeltaBase> delta_base) {
+            this->delta_base = std::move(delta_base);
+        }
+
+        uint64_t base_hash(int local_index) const {
+            if (!delta_base || (size_t) local_index >= delta_base->local_hashes.size()) {
+                return 0;
+            }
+            return delta_base->local_hashes[local_index];
+        }
+
         void set_sizehint(size_t sizehint) {
             this->sizehint = sizehint;
+            this->sizehint_given = true;
         }
 
         void set_module_name(std::optional<std::string> module_name) {
@@ -66,45 +176,506 @@ namespace serdes {
         }
     };
     
+    // Tuples up to this size (and nesting depth) whose items are all native
+    // are encoded natively too; anything bigger goes through pickle.
+    constexpr Py_ssize_t NATIVE_TUPLE_MAX_SIZE = 16;
+    constexpr int NATIVE_TUPLE_MAX_DEPTH = 4;
+
+    // Whether obj can be encoded without pickle. Only exact types qualify, so
+    // subclasses keep their type by going through pickle.
+    inline bool is_native_encodable(PyObject *obj, int depth = 0) {
+        if (obj == Py_None || PyBool_Check(obj) || PyFloat_CheckExact(obj) || PyBytes_CheckExact(obj)) {
+            return true;
+        }
+        if (PyLong_CheckExact(obj)) {
+            int overflow = 0;
+            PyLong_AsLongLongAndOverflow(obj, &overflow);
+            return overflow == 0;
+        }
+        if (PyUnicode_CheckExact(obj)) {
+            if (NULL == PyUnicode_AsUTF8AndSize(obj, NULL)) {
+                // e.g. lone surrogates; let pickle deal with them.
+                PyErr_Clear();
+                return false;
+            }
+            return true;
+        }
+        if (PyTuple_CheckExact(obj)) {
+            Py_ssize_t size = PyTuple_GET_SIZE(obj);
+            if (depth >= NATIVE_TUPLE_MAX_DEPTH || size > NATIVE_TUPLE_MAX_SIZE) {
+                return false;
+            }
+            for (Py_ssize_t i = 0; i < size; i++) {
+                if (!is_native_encodable(PyTuple_GET_ITEM(obj, i), depth + 1)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        return false;
+    }
+
+    // Collects the non-native objects a frame refers to, once each, so they
+    // can be pickled together and referenced by index. Objects are borrowed;
+    // the frame being serialized keeps them alive.
+    class SharedObjectTable {
+        std::vector<PyObject*> objects;
+        std::unordered_map<PyObject*, int32_t> indices;
+        // A frame's table inside a batch leaves out what the batch's own
+        // table already holds.
+        const SharedObjectTable *outer = nullptr;
+        public:
+        SharedObjectTable() = default;
+        explicit SharedObjectTable(const SharedObjectTable *outer) : outer(outer) {}
+
+        void add(PyObject *obj) {
+            if (NULL == obj || is_native_encodable(obj)) {
+                return;
+            }
+            if (outer != nullptr && outer->index_of(obj) >= 0) {
+                return;
+            }
+            if (indices.emplace(obj, (int32_t) objects.size()).second) {
+                objects.push_back(obj);
+            }
+        }
+
+        void add(_PyStackRef ref) {
+            if (utils::py::stackref_is_null(ref) || utils::py::stackref_is_tagged_int(ref)) {
+                return;
+            }
+            add(utils::py::stackref_as_pyobject(ref));
+        }
+
+        // -1 if obj is not in the table.
+        int32_t index_of(PyObject *obj) const {
+            auto it = indices.find(obj);
+            return (it != indices.end()) ? it->second : -1;
+        }
+
+        bool empty() const {
+            return objects.empty();
+        }
+
+        const SharedObjectTable *enclosing() const {
+            return outer;
+        }
+
+        const std::vector<PyObject*> &items() const {
+            return objects;
+        }
+
+        pyobject_strongref as_list() const {
+            auto list = pyobject_strongref::steal(PyList_New(objects.size()));
+            if (!list) {
+                return list;
+            }
+            for (size_t i = 0; i < objects.size(); i++) {
+                PyList_SET_ITEM(list.borrow(), i, Py_NewRef(objects[i]));
+            }
+            return list;
+        }
+    };
+
+    // Everything a frame refers to that belongs in its shared object table.
+    inline void add_frame_objects(SharedObjectTable &table, sauerkraut::PyInterpreterFrame &obj, int stack_depth,
+                                  const SerializationArgs &ser_args) {
+        if (!ser_args.exclude_immutables) {
+            table.add(utils::py::get_funcobj(&obj));
+        }
+        table.add(obj.f_locals);
+        auto n_locals = utils::py::get_code_nlocals(
+            (PyCodeObject*)utils::py::stackref_as_pyobject(obj.f_executable));
+        for (int i = 0; i < n_locals; i++) {
+            if (!ser_args.exclude_locals || !ser_args.exclude_locals.value()[i]) {
+                table.add(obj.localsplus[i]);
+            }
+        }
+        _PyStackRef *stack_base = utils::py::get_stack_base(&obj);
+        for (int i = 0; i < stack_depth; i++) {
+            table.add(stack_base[i]);
+        }
+    }
+
+    inline void add_frame_objects(SharedObjectTable &table, sauerkraut::PyFrame &frame, const SerializationArgs &ser_args) {
+        int stack_depth = utils::py::get_stack_state((PyObject*)&frame).size();
+        add_frame_objects(table, *frame.f_frame, stack_depth, ser_args);
+    }
+
+    // What the frames of one batch (serialize_frames) have in common. The
+    // first frame that needs a part serializes it, and later frames point
+    // at the same offset.
+    struct BatchContext {
+        std::unordered_map<PyObject*, offsets::PyCodeObjectOffset> code_objects;
+        std::unordered_map<PyObject*, offsets::PyObjectOffset> globals;
+        std::unordered_map<std::string, flatbuffers::Offset<flatbuffers::Vector<uint8_t>>> module_sources;
+        // Objects referenced from more than one frame.
+        SharedObjectTable shared;
+    };
+
+    // The deserializing side of a batch. Frames that point at the same
+    // globals get the same dict, and each module source is run once.
+    struct BatchReadContext {
+        pyobject_strongref shared;
+        std::unordered_map<const pyframe_buffer::PyObject*, pyobject_strongref> globals;
+        std::unordered_set<const void*> bootstrapped_sources;
+    };
+
     template<typename Loads, typename Dumps>
     class PyObjectSerdes {
         Loads loads;
         Dumps dumps;
+        compression::Settings compression;
+
+        // Store a pickled payload, compressed if it is large enough and
+        // compression actually makes it smaller.
+        template<typename Builder>
+        offsets::PyObjectOffset serialize_payload(Builder &builder, const uint8_t *data, size_t size,
+                                                  Py_ssize_t oob_first = 0, Py_ssize_t oob_count = 0,
+                                                  uint64_t content_hash = 0) {
+            if (compression.enabled() && size >= compression.threshold) {
+                std::vector<uint8_t> compressed;
+                if (compression::compress(compression, data, size, compressed) && compressed.size() < size) {
+                    auto bytes = builder.CreateVector(compressed);
+                    return pyframe_buffer::CreatePyObject(builder, bytes, oob_first, oob_count,
+                        pyframe_buffer::NativeValue_NONE, 0, -1, compression.codec, size, content_hash);
+                }
+            }
+            auto bytes = builder.CreateVector(data, size);
+            return pyframe_buffer::CreatePyObject(builder, bytes, oob_first, oob_count,
+                pyframe_buffer::NativeValue_NONE, 0, -1, pyframe_buffer::Codec_Uncompressed, 0, content_hash);
+        }
+
+        // Never 0, which marks a missing hash. The seed keeps a str and a
+        // bytes object with the same contents apart.
+        static uint64_t content_hash(const void *data, size_t size, pyframe_buffer::NativeValue kind) {
+            uint64_t hash = utils::hash::xxh64(data, size, (uint64_t) kind);
+            return (hash != 0) ? hash : 1;
+        }
+
+        template<typename Builder>
+        offsets::PyObjectOffset serialize_base_ref(Builder &builder, uint64_t content_hash) {
+            return pyframe_buffer::CreatePyObject(builder, 0, 0, 0, pyframe_buffer::NativeValue_NONE, 0, -1,
+                pyframe_buffer::Codec_Uncompressed, 0, content_hash, true);
+        }
+
+        // Pickle obj. With a base_hash, the payload's hash is recorded and
+        // the payload is left out if it matches.
+        template<typename Builder>
+        offsets::PyObjectOffset serialize_pickled(Builder &builder, PyObject *obj, std::optional<uint64_t> base_hash) {
+            // Any buffers the pickler hands out of band while dumping obj
+            // are appended to the dumper's list; remember which ones are ours.
+            Py_ssize_t oob_first = dumps.out_of_band_count();
+            auto dumps_result = dumps(obj);
+            if(NULL == dumps_result.borrow()) {
+                return 0;
+            }
+            Py_ssize_t size = 0;
+            char *pickled_data;
+            if(PyBytes_AsStringAndSize(*dumps_result, &pickled_data, &size) == -1) {
+                return 0;
+            }
+            Py_ssize_t oob_count = dumps.out_of_band_count() - oob_first;
+            // The hash would not cover out-of-band buffers, so such objects
+            // are always stored in full.
+            if (!base_hash || oob_count > 0) {
+                return serialize_payload(builder, (const uint8_t *)pickled_data, size, oob_first, oob_count);
+            }
+            uint64_t hash = content_hash(pickled_data, size, pyframe_buffer::NativeValue_NONE);
+            if (hash == base_hash.value()) {
+                return serialize_base_ref(builder, hash);
+            }
+            return serialize_payload(builder, (const uint8_t *)pickled_data, size, 0, 0, hash);
+        }
+
+        // The pickled payload of obj, ready for loads: a view straight into
+        // the frame buffer, or a decompressed copy.
+        pyobject_strongref payload(const pyframe_buffer::PyObject *obj) {
+            auto data = obj->data();
+            if (NULL == data) {
+                PyErr_SetString(PyExc_ValueError, "Serialized object has no payload.");
+                return pyobject_strongref(NULL);
+            }
+            if (obj->codec() == pyframe_buffer::Codec_Uncompressed) {
+                // pickle copies whatever it keeps, so the view never
+                // outlives the loads call.
+                return pyobject_strongref::steal(
+                    PyMemoryView_FromMemory((char*)data->data(), data->size(), PyBUF_READ));
+            }
+            if (!compression::available(obj->codec())) {
+                PyErr_Format(PyExc_ValueError, "Serialized frame uses the '%s' codec, which is not available in this build.",
+                             compression::codec_name(obj->codec()));
+                return pyobject_strongref(NULL);
+            }
+            auto raw = pyobject_strongref::steal(PyBytes_FromStringAndSize(NULL, obj->raw_size()));
+            if (!raw) {
+                return raw;
+            }
+            if (!compression::decompress(obj->codec(), data->data(), data->size(),
+                                         (uint8_t *) PyBytes_AS_STRING(raw.borrow()), obj->raw_size())) {
+                PyErr_SetString(PyExc_ValueError, "Failed to decompress a serialized object.");
+                return pyobject_strongref(NULL);
+            }
+            return raw;
+        }
+
+        // obj must satisfy is_native_encodable.
+        template<typename Builder>
+        offsets::PyObjectOffset serialize_native(Builder &builder, PyObject *obj) {
+            if (obj == Py_None) {
+                auto value = pyframe_buffer::CreateNativeNone(builder);
+                return pyframe_buffer::CreatePyObject(builder, 0, 0, 0,
+                    pyframe_buffer::NativeValue_NativeNone, value.Union());
+            }
+            if (PyBool_Check(obj)) {
+                auto value = pyframe_buffer::CreateNativeBool(builder, obj == Py_True);
+                return pyframe_buffer::CreatePyObject(builder, 0, 0, 0,
+                    pyframe_buffer::NativeValue_NativeBool, value.Union());
+            }
+            if (PyLong_CheckExact(obj)) {
+                return serialize_int(builder, PyLong_AsLongLong(obj));
+            }
+            if (PyFloat_CheckExact(obj)) {
+                auto value = pyframe_buffer::CreateNativeFloat(builder, PyFloat_AS_DOUBLE(obj));
+                return pyframe_buffer::CreatePyObject(builder, 0, 0, 0,
+                    pyframe_buffer::NativeValue_NativeFloat, value.Union());
+            }
+            if (PyUnicode_CheckExact(obj)) {
+                Py_ssize_t size = 0;
+                const char *utf8 = PyUnicode_AsUTF8AndSize(obj, &size);
+                return serialize_str(builder, utf8, size);
+            }
+            if (PyBytes_CheckExact(obj)) {
+                return serialize_bytes(builder, PyBytes_AS_STRING(obj), PyBytes_GET_SIZE(obj));
+            }
+
+            Py_ssize_t size = PyTuple_GET_SIZE(obj);
+            std::vector<offsets::PyObjectOffset> items;
+            items.reserve(size);
+            for (Py_ssize_t i = 0; i < size; i++) {
+                items.push_back(serialize_native(builder, PyTuple_GET_ITEM(obj, i)));
+            }
+            auto items_ser = builder.CreateVector(items);
+            auto value = pyframe_buffer::CreateNativeTuple(builder, items_ser);
+            return pyframe_buffer::CreatePyObject(builder, 0, 0, 0,
+                pyframe_buffer::NativeValue_NativeTuple, value.Union());
+        }
+
+        // Compress a native string or bytes value the same way as a
+        // pickled payload. The compressed bytes go in data and the native
+        // table is left empty; nullopt means store the value as-is.
+        template<typename Builder>
+        std::optional<offsets::PyObjectOffset> serialize_compressed_native(Builder &builder, const char *data, size_t size,
+                                                                           pyframe_buffer::NativeValue native_type,
+                                                                           uint64_t content_hash) {
+            if (!compression.enabled() || size < compression.threshold) {
+                return std::nullopt;
+            }
+            std::vector<uint8_t> compressed;
+            if (!compression::compress(compression, (const uint8_t *) data, size, compressed) || compressed.size() >= size) {
+                return std::nullopt;
+            }
+            auto bytes = builder.CreateVector(compressed);
+            auto value = (native_type == pyframe_buffer::NativeValue_NativeStr)
+                ? pyframe_buffer::CreateNativeStr(builder).Union()
+                : pyframe_buffer::CreateNativeBytes(builder).Union();
+            return pyframe_buffer::CreatePyObject(builder, bytes, 0, 0, native_type, value, -1,
+                compression.codec, size, content_hash);
+        }
+
+        template<typename Builder>
+        offsets::PyObjectOffset serialize_str(Builder &builder, const char *utf8, Py_ssize_t size,
+                                              uint64_t content_hash = 0) {
+            auto compressed = serialize_compressed_native(builder, utf8, size,
+                pyframe_buffer::NativeValue_NativeStr, content_hash);
+            if (compressed) {
+                return *compressed;
+            }
+            auto str = builder.CreateString(utf8, size);
+            auto value = pyframe_buffer::CreateNativeStr(builder, str);
+            return pyframe_buffer::CreatePyObject(builder, 0, 0, 0, pyframe_buffer::NativeValue_NativeStr,
+                value.Union(), -1, pyframe_buffer::Codec_Uncompressed, 0, content_hash);
+        }
+
+        template<typename Builder>
+        offsets::PyObjectOffset serialize_bytes(Builder &builder, const char *data, Py_ssize_t size,
+                                                uint64_t content_hash = 0) {
+            auto compressed = serialize_compressed_native(builder, data, size,
+                pyframe_buffer::NativeValue_NativeBytes, content_hash);
+            if (compressed) {
+                return *compressed;
+            }
+            auto bytes = builder.CreateVector((const uint8_t *) data, size);
+            auto value = pyframe_buffer::CreateNativeBytes(builder, bytes);
+            return pyframe_buffer::CreatePyObject(builder, 0, 0, 0, pyframe_buffer::NativeValue_NativeBytes,
+                value.Union(), -1, pyframe_buffer::Codec_Uncompressed, 0, content_hash);
+        }
+
+        template<typename Builder>
+        offsets::PyObjectOffset serialize_int(Builder &builder, int64_t int_value) {
+            auto value = pyframe_buffer::CreateNativeInt(builder, int_value);
+            return pyframe_buffer::CreatePyObject(builder, 0, 0, 0,
+                pyframe_buffer::NativeValue_NativeInt, value.Union());
+        }
+
+        pyobject_strongref deserialize_native(const pyframe_buffer::PyObject *obj) {
+            switch (obj->native_type()) {
+                case pyframe_buffer::NativeValue_NativeInt:
+                    return pyobject_strongref::steal(PyLong_FromLongLong(obj->native_as_NativeInt()->value()));
+                case pyframe_buffer::NativeValue_NativeFloat:
+                    return pyobject_strongref::steal(PyFloat_FromDouble(obj->native_as_NativeFloat()->value()));
+                case pyframe_buffer::NativeValue_NativeBool:
+                    return pyobject_strongref(obj->native_as_NativeBool()->value() ? Py_True : Py_False);
+                case pyframe_buffer::NativeValue_NativeNone:
+                    return pyobject_strongref(Py_None);
+                case pyframe_buffer::NativeValue_NativeStr: {
+                    if (obj->codec() != pyframe_buffer::Codec_Uncompressed) {
+                        auto raw = payload(obj);
+                        if (!raw) {
+                            return raw;
+                        }
+                        return pyobject_strongref::steal(PyUnicode_DecodeUTF8(
+                            PyBytes_AS_STRING(raw.borrow()), PyBytes_GET_SIZE(raw.borrow()), NULL));
+                    }
+                    auto str = obj->native_as_NativeStr()->value();
+                    if (NULL == str) {
+                        return pyobject_strongref::steal(PyUnicode_FromStringAndSize("", 0));
+                    }
+                    return pyobject_strongref::steal(PyUnicode_DecodeUTF8(str->c_str(), str->size(), NULL));
+                }
+                case pyframe_buffer::NativeValue_NativeBytes: {
+                    if (obj->codec() != pyframe_buffer::Codec_Uncompressed) {
+                        return payload(obj);
+                    }
+                    auto bytes = obj->native_as_NativeBytes()->value();
+                    if (NULL == bytes) {
+                        return pyobject_strongref::steal(PyBytes_FromStringAndSize("", 0));
+                    }
+                    return pyobject_strongref::steal(PyBytes_FromStringAndSize((const char *) bytes->data(), bytes->size()));
+                }
+                case pyframe_buffer::NativeValue_NativeTuple: {
+                    auto items = obj->native_as_NativeTuple()->items();
+                    Py_ssize_t size = (NULL != items) ? items->size() : 0;
+                    auto tuple = pyobject_strongref::steal(PyTuple_New(size));
+                    if (!tuple) {
+                        return tuple;
+                    }
+                    for (Py_ssize_t i = 0; i < size; i++) {
+                        auto item = deserialize(items->Get(i));
+                        if (!item) {
+                            return pyobject_strongref(NULL);
+                        }
+                        PyTuple_SET_ITEM(tuple.borrow(), i, Py_NewRef(item.borrow()));
+                    }
+                    return tuple;
+                }
+                default:
+                    PyErr_SetString(PyExc_ValueError, "Serialized frame contains an unknown native value type");
+                    return pyobject_strongref(NULL);
+            }
+        }
+
         public:
             PyObjectSerdes(Loads& loads, Dumps& dumps) :
                 loads(loads), dumps(dumps) {
             }
 
+            void set_compression(compression::Settings compression) {
+                this->compression = compression;
+            }
+
+            // Serialize the object behind a stack reference. Tagged ints
+            // (3.14) are encoded directly instead of being boxed first.
+            template<typename Builder>
+            offsets::PyObjectOffset serialize(Builder &builder, _PyStackRef ref) {
+                if (utils::py::stackref_is_tagged_int(ref)) {
+                    return serialize_int(builder, (int64_t) utils::py::stackref_untag_int(ref));
+                }
+                return serialize(builder, utils::py::stackref_as_pyobject(ref));
+            }
+
             template<typename Builder>
             offsets::PyObjectOffset serialize(Builder &builder, PyObject *obj) {
-                auto dumps_result = dumps(obj);
-                if(NULL == dumps_result.borrow()) {
-                    return 0;
+                if (is_native_encodable(obj)) {
+                    return serialize_native(builder, obj);
                 }
-                Py_ssize_t size = 0;
-                char *pickled_data;
-                if(PyBytes_AsStringAndSize(*dumps_result, &pickled_data, &size) == -1) {
-                    return 0;
+                return serialize_pickled(builder, obj, std::nullopt);
+            }
+
+            // Serialize a local for an incremental frame. Its content hash is
+            // recorded, and if it equals base_hash (the hash of the same local
+            // in the base frame) only a reference to the base is stored.
+            template<typename Builder>
+            offsets::PyObjectOffset serialize_delta(Builder &builder, _PyStackRef ref, uint64_t base_hash) {
+                if (utils::py::stackref_is_tagged_int(ref)) {
+                    return serialize_int(builder, (int64_t) utils::py::stackref_untag_int(ref));
+                }
+                return serialize_delta(builder, utils::py::stackref_as_pyobject(ref), base_hash);
+            }
+
+            template<typename Builder>
+            offsets::PyObjectOffset serialize_delta(Builder &builder, PyObject *obj, uint64_t base_hash) {
+                if (!is_native_encodable(obj)) {
+                    return serialize_pickled(builder, obj, base_hash);
+                }
+                // Of the native values only strings and bytes are big
+                // enough to be worth referring to.
+                if (PyUnicode_CheckExact(obj)) {
+                    Py_ssize_t size = 0;
+                    const char *utf8 = PyUnicode_AsUTF8AndSize(obj, &size);
+                    uint64_t hash = content_hash(utf8, size, pyframe_buffer::NativeValue_NativeStr);
+                    if (hash == base_hash) {
+                        return serialize_base_ref(builder, hash);
+                    }
+                    return serialize_str(builder, utf8, size, hash);
+                }
+                if (PyBytes_CheckExact(obj)) {
+                    const char *data = PyBytes_AS_STRING(obj);
+                    Py_ssize_t size = PyBytes_GET_SIZE(obj);
+                    uint64_t hash = content_hash(data, size, pyframe_buffer::NativeValue_NativeBytes);
+                    if (hash == base_hash) {
+                        return serialize_base_ref(builder, hash);
+                    }
+                    return serialize_bytes(builder, data, size, hash);
                 }
-                auto bytes = builder.CreateVector((const uint8_t *)pickled_data, size);
-                auto py_obj = pyframe_buffer::CreatePyObject(builder, bytes);
+                return serialize_native(builder, obj);
+            }
 
-                return py_obj;
+            // Sizes of the out-of-band buffers collected so far, in the
+            // order objects refer to them.
+            std::vector<uint64_t> out_of_band_sizes() {
+                std::vector<uint64_t> sizes;
+                PyObject *buffers = dumps.out_of_band_buffers();
+                if(NULL == buffers) {
+                    return sizes;
+                }
+                Py_ssize_t n_buffers = PyList_GET_SIZE(buffers);
+                sizes.reserve(n_buffers);
+                for(Py_ssize_t i = 0; i < n_buffers; i++) {
+                    const Py_buffer *view = PyPickleBuffer_GetBuffer(PyList_GET_ITEM(buffers, i));
+                    sizes.push_back(NULL != view ? view->len : 0);
+                }
+                return sizes;
             }
 
             auto deserialize(const pyframe_buffer::PyObject *obj) -> decltype(loads(nullptr)) {
                 if(NULL == obj) {
                     return NULL;
                 }
+                if(obj->in_base()) {
+                    PyErr_SetString(PyExc_ValueError,
+                        "Serialized frame is a delta; pass its base frames to deserialize_frame as well.");
+                    return NULL;
+                }
+                if(obj->native_type() != pyframe_buffer::NativeValue_NONE) {
+                    return deserialize_native(obj);
+                }
 
-                auto data = obj->data()->data();
-                auto size = obj->data()->size();
-
-                if(NULL == data) {
+                auto pickled = payload(obj);
+                if(!pickled) {
                     return NULL;
                 }
-                auto bytes = pyobject_strongref::steal(PyBytes_FromStringAndSize((const char*)data, size));
-                auto retval = loads(bytes.borrow());
+                auto retval = loads(pickled.borrow(), obj->oob_first(), obj->oob_count());
                 return retval;
             }
 
@@ -119,11 +690,8 @@ namespace serdes {
                 if(PyBytes_AsStringAndSize(*dumps_result, &pickled_data, &size) == -1) {
                     return 0;
                 }
-                
-                auto bytes = builder.CreateVector((const uint8_t *)pickled_data, size);
-                auto py_obj = pyframe_buffer::CreatePyObject(builder, bytes);
 
-                return py_obj;
+                return serialize_payload(builder, (const uint8_t *)pickled_data, size);
             }
 
             auto deserialize_dill(const pyframe_buffer::PyObject *obj) -> decltype(loads(nullptr)) {
@@ -131,14 +699,11 @@ namespace serdes {
                     return NULL;
                 }
 
-                auto data = obj->data()->data();
-                auto size = obj->data()->size();
-
-                if(NULL == data) {
+                auto pickled = payload(obj);
+                if(!pickled) {
                     return NULL;
                 }
-                auto bytes = pyobject_strongref::steal(PyBytes_FromStringAndSize((const char*)data, size));
-                auto retval = loads.dill_loads(bytes.borrow());
+                auto retval = loads.dill_loads(pickled.borrow());
                 return retval;
             }
 
@@ -227,6 +792,8 @@ namespace serdes {
 
         std::vector<unsigned char> co_code_adaptive;
 
+        std::optional<utils::hash::Hash128> content_hash;
+
         bool immutables_included() {
             if(co_consts.borrow()) {
                 return true;
@@ -242,14 +809,14 @@ namespace serdes {
     template <typename PyCodeObjectSerializer>
     class PyCodeObjectSerdes {
         PyCodeObjectSerializer po_serializer;
+        // Returns 0 with an exception set on failure.
         template<typename Builder>
         flatbuffers::Offset<flatbuffers::Vector<uint8_t>> serialize_bitcode(Builder &builder, PyCodeObject *code) {
-            pyobject_strongref code_instrs = pyobject_strongref::steal(PyCode_GetCode(code));
-            Py_ssize_t total_size_bytes = 0;
-            char *bitcode = nullptr;
-            PyBytes_AsStringAndSize(code_instrs.borrow(), &bitcode, &total_size_bytes);
-
-            auto bytes = builder.CreateVector((const uint8_t*) bitcode, total_size_bytes);
+            PyObject *code_instrs = sauerkraut::get_deopt_code(code);
+            if (code_instrs == NULL) {
+                return 0;
+            }
+            auto bytes = builder.CreateVector((const uint8_t*) PyBytes_AS_STRING(code_instrs), PyBytes_GET_SIZE(code_instrs));
             return bytes;
         }
 
@@ -259,7 +826,12 @@ namespace serdes {
 
         template<typename Builder>
         offsets::PyCodeObjectOffset serialize(Builder &builder, PyCodeObject *obj, serdes::SerializationArgs& ser_args) {
-            // Always serialize co_name as it's used as a key for lookup
+            // The content hash is the cache key for frames that exclude
+            // immutables; co_name is kept for error messages and tools.
+            auto content_hash = sauerkraut::code_content_hash(obj);
+            if (!content_hash) {
+                PyErr_Clear();
+            }
             auto co_name_ser = (NULL != obj->co_name) ?
                 std::optional{po_serializer.serialize(builder, obj->co_name)} : std::nullopt;
             
@@ -302,6 +874,9 @@ namespace serdes {
                 // Only serialize bytecode if we're not excluding immutables
                 co_code_adaptive_ser = serialize_bitcode(builder, obj);
             }
+            if (PyErr_Occurred()) {
+                return 0;
+            }
 
             pyframe_buffer::PyCodeObjectBuilder code_builder(builder);
 
@@ -344,7 +919,12 @@ namespace serdes {
                 code_builder.add_co_filename(co_filename_ser.value());
             }
             
-            // Always add co_name as it's our lookup key
+            if (content_hash) {
+                code_builder.add_content_hash_low(content_hash->low);
+                code_builder.add_content_hash_high(content_hash->high);
+            }
+
+            // Always add co_name
             if (co_name_ser) {
                 code_builder.add_co_name(co_name_ser.value());
             }
@@ -398,6 +978,10 @@ namespace serdes {
                 deser.co_code_adaptive = std::vector<unsigned char>(bitcode->begin(), bitcode->end());
             }
 
+            if (obj->content_hash_low() != 0 || obj->content_hash_high() != 0) {
+                deser.content_hash = utils::hash::Hash128{obj->content_hash_low(), obj->content_hash_high()};
+            }
+
             return deser;
         }
 
@@ -534,21 +1118,95 @@ namespace serdes {
         }
 
         template <typename Builder>
-        flatbuffers::Offset<flatbuffers::Vector<offsets::PyObjectOffset>> serialize_stack(Builder &builder, sauerkraut::PyInterpreterFrame &obj, int stack_depth) {
+        offsets::PyObjectOffset serialize_slot(Builder &builder, PyObject *obj, const SharedObjectTable &shared) {
+            int32_t index = shared.index_of(obj);
+            if (index >= 0) {
+                return pyframe_buffer::CreatePyObject(builder, 0, 0, 0, pyframe_buffer::NativeValue_NONE, 0, index);
+            }
+            if (shared.enclosing() != nullptr) {
+                int32_t batch_index = shared.enclosing()->index_of(obj);
+                if (batch_index >= 0) {
+                    return pyframe_buffer::CreatePyObject(builder, 0, 0, 0, pyframe_buffer::NativeValue_NONE, 0, -1,
+                        pyframe_buffer::Codec_Uncompressed, 0, 0, false, batch_index);
+                }
+            }
+            return po_serializer.serialize(builder, obj);
+        }
+
+        template <typename Builder>
+        offsets::PyObjectOffset serialize_slot(Builder &builder, _PyStackRef ref, const SharedObjectTable &shared) {
+            if (utils::py::stackref_is_tagged_int(ref)) {
+                return po_serializer.serialize(builder, ref);
+            }
+            return serialize_slot(builder, utils::py::stackref_as_pyobject(ref), shared);
+        }
+
+        // Follow a local stored as in_base back through the chain of base
+        // frames (oldest first) to the frame that holds its payload.
+        pyobject_strongref deserialize_from_base(const pyframe_buffer::PyObject *obj, int local_index,
+                                                 const std::vector<std::vector<const pyframe_buffer::PyObject*>> &base_slots) {
+            for (auto it = base_slots.rbegin(); it != base_slots.rend(); ++it) {
+                if ((size_t) local_index >= it->size() || (*it)[local_index] == NULL) {
+                    break;
+                }
+                auto base_obj = (*it)[local_index];
+                if (base_obj->content_hash() != obj->content_hash()) {
+                    break;
+                }
+                if (!base_obj->in_base()) {
+                    return po_serializer.deserialize(base_obj);
+                }
+            }
+            PyErr_Format(PyExc_ValueError,
+                "Local %d of the delta frame does not match any frame in its base chain.", local_index);
+            return pyobject_strongref(NULL);
+        }
+
+        pyobject_strongref deserialize_globals(const pyframe_buffer::PyObject *obj, BatchReadContext *batch) {
+            if (batch == nullptr) {
+                return po_serializer.deserialize_dill(obj);
+            }
+            auto cached = batch->globals.find(obj);
+            if (cached != batch->globals.end()) {
+                return cached->second;
+            }
+            auto globals = po_serializer.deserialize_dill(obj);
+            if (globals) {
+                batch->globals.emplace(obj, globals);
+            }
+            return globals;
+        }
+
+        pyobject_strongref deserialize_slot(const pyframe_buffer::PyObject *obj, PyObject *shared, BatchReadContext *batch = nullptr) {
+            if (NULL != obj && obj->batch_index() >= 0) {
+                if (NULL == batch || !batch->shared || obj->batch_index() >= PyList_GET_SIZE(batch->shared.borrow())) {
+                    PyErr_SetString(PyExc_ValueError, "Serialized frame refers to a missing batch object.");
+                    return pyobject_strongref(NULL);
+                }
+                return pyobject_strongref(PyList_GET_ITEM(batch->shared.borrow(), obj->batch_index()));
+            }
+            if (NULL == obj || obj->table_index() < 0) {
+                return po_serializer.deserialize(obj);
+            }
+            if (NULL == shared || obj->table_index() >= PyList_GET_SIZE(shared)) {
+                PyErr_SetString(PyExc_ValueError, "Serialized frame refers to a missing shared object.");
+                return pyobject_strongref(NULL);
+            }
+            return pyobject_strongref(PyList_GET_ITEM(shared, obj->table_index()));
+        }
+
+        template <typename Builder>
+        flatbuffers::Offset<flatbuffers::Vector<offsets::PyObjectOffset>> serialize_stack(Builder &builder, sauerkraut::PyInterpreterFrame &obj, int stack_depth, const SharedObjectTable &shared) {
             std::vector<offsets::PyObjectOffset> stack;
             stack.reserve(stack_depth);
 
             _PyStackRef *stack_base = utils::py::get_stack_base(&obj);
             for(size_t i = 0; i < (size_t) stack_depth; i++) {
-                auto stack_obj = utils::py::stackref_to_object_for_serialization(stack_base[i]);
-                if (stack_obj.obj == NULL) {
+                if (utils::py::stackref_is_null(stack_base[i])) {
                     continue;
                 }
-                auto stack_obj_ser = po_serializer.serialize(builder, stack_obj.obj);
+                auto stack_obj_ser = serialize_slot(builder, stack_base[i], shared);
                 stack.push_back(stack_obj_ser);
-                if (stack_obj.owned) {
-                    Py_DECREF(stack_obj.obj);
-                }
             }
 
             auto stack_offset = builder.CreateVector(stack);
@@ -557,7 +1215,7 @@ namespace serdes {
         template<typename Builder>
         std::pair<flatbuffers::Offset<flatbuffers::Vector<offsets::PyObjectOffset>>, 
                   flatbuffers::Offset<flatbuffers::Vector<uint8_t>>> 
-        serialize_fast_locals_plus(Builder &builder, sauerkraut::PyInterpreterFrame &obj, serdes::SerializationArgs& ser_args) {
+        serialize_fast_locals_plus(Builder &builder, sauerkraut::PyInterpreterFrame &obj, serdes::SerializationArgs& ser_args, const SharedObjectTable &shared) {
             auto n_locals = utils::py::get_code_nlocals(
                 (PyCodeObject*)utils::py::stackref_as_pyobject(obj.f_executable));
             auto exclude_local_bitmask = ser_args.exclude_locals.value_or(std::vector<bool>(n_locals, false));
@@ -582,20 +1240,14 @@ namespace serdes {
             // Only serialize non-excluded locals
             for(int i = 0; i < n_locals; i++) {
                 auto local = obj.localsplus[i];
-                auto local_pyobj = utils::py::stackref_to_object_for_serialization(local);
-
-                if(NULL == local_pyobj.obj || exclude_local_bitmask[i]) {
-                    if (local_pyobj.owned) {
-                        Py_DECREF(local_pyobj.obj);
-                    }
+                if(utils::py::stackref_is_null(local) || exclude_local_bitmask[i]) {
                     continue;
                 }
 
-                auto local_ser = po_serializer.serialize(builder, local_pyobj.obj);
+                auto local_ser = ser_args.incremental ?
+                    po_serializer.serialize_delta(builder, local, ser_args.base_hash(i)) :
+                    serialize_slot(builder, local, shared);
                 localsplus.push_back(local_ser);
-                if (local_pyobj.owned) {
-                    Py_DECREF(local_pyobj.obj);
-                }
             }
 
             auto localsplus_offset = builder.CreateVector(localsplus);
@@ -604,6 +1256,38 @@ namespace serdes {
             return std::make_pair(localsplus_offset, bitmask_offset);
         }
 
+        template <typename Builder>
+        offsets::PyObjectOffset serialize_globals(Builder &builder, PyObject *globals, serdes::SerializationArgs& ser_args) {
+            if (!ser_args.batch) {
+                return po_serializer.serialize_dill(builder, globals);
+            }
+            auto cached = ser_args.batch->globals.find(globals);
+            if (cached != ser_args.batch->globals.end()) {
+                return cached->second;
+            }
+            auto globals_ser = po_serializer.serialize_dill(builder, globals);
+            if (!globals_ser.IsNull()) {
+                ser_args.batch->globals.emplace(globals, globals_ser);
+            }
+            return globals_ser;
+        }
+
+        template <typename Builder>
+        flatbuffers::Offset<flatbuffers::Vector<uint8_t>> serialize_module_source(Builder &builder, const std::vector<uint8_t> &source,
+                                                                                 serdes::SerializationArgs& ser_args) {
+            if (!ser_args.batch) {
+                return builder.CreateVector(source);
+            }
+            std::string key(source.begin(), source.end());
+            auto cached = ser_args.batch->module_sources.find(key);
+            if (cached != ser_args.batch->module_sources.end()) {
+                return cached->second;
+            }
+            auto source_ser = builder.CreateVector(source);
+            ser_args.batch->module_sources.emplace(std::move(key), source_ser);
+            return source_ser;
+        }
+
         public:
         PyInterpreterFrameSerdes(PyObjectSerializer& po_serializer) : 
             po_serializer(po_serializer),
@@ -616,30 +1300,70 @@ namespace serdes {
             offsets::PyObjectOffset f_globals_ser = 0;
             bool has_f_funcobj = false;
 
-            f_executable_ser = code_serializer.serialize(
-                builder, (PyCodeObject*)utils::py::stackref_as_pyobject(obj.f_executable), ser_args);
+            sauerkraut::stats::SectionBytes section_bytes(builder);
+            PyObject *code = utils::py::stackref_as_pyobject(obj.f_executable);
+            if (ser_args.batch && ser_args.batch->code_objects.count(code)) {
+                f_executable_ser = ser_args.batch->code_objects[code];
+            } else {
+                f_executable_ser = code_serializer.serialize(builder, (PyCodeObject*)code, ser_args);
+                if (PyErr_Occurred()) {
+                    return 0;
+                }
+                if (ser_args.batch) {
+                    ser_args.batch->code_objects.emplace(code, f_executable_ser);
+                }
+            }
+            section_bytes.add(sauerkraut::stats::BYTES_CODE);
+
+            // Pickle every non-native object the frame refers to in one go,
+            // so aliases share a single copy. Incremental frames skip this:
+            // their locals are pickled one by one so each can be compared
+            // with the base on its own.
+            SharedObjectTable shared(ser_args.batch ? &ser_args.batch->shared : nullptr);
+            PyObject *func_obj = ser_args.exclude_immutables ? NULL : utils::py::get_funcobj(&obj);
+            if (!ser_args.incremental) {
+                add_frame_objects(shared, obj, stack_depth, ser_args);
+            }
+
+            std::optional<offsets::PyObjectOffset> shared_ser = std::nullopt;
+            if (!shared.empty()) {
+                auto shared_list = shared.as_list();
+                if (!shared_list) {
+                    return 0;
+                }
+                shared_ser = po_serializer.serialize(builder, shared_list.borrow());
+            }
+            section_bytes.add(sauerkraut::stats::BYTES_SHARED_OBJECTS);
+
             if(!ser_args.exclude_immutables) {
-                PyObject *func_obj = utils::py::get_funcobj(&obj);
                 if (func_obj != NULL) {
-                    f_func_obj_ser = po_serializer.serialize(builder, func_obj);
+                    f_func_obj_ser = serialize_slot(builder, func_obj, shared);
                     has_f_funcobj = true;
                 }
-                f_globals_ser = po_serializer.serialize_dill(builder, obj.f_globals);
+                f_globals_ser = serialize_globals(builder, obj.f_globals, ser_args);
             }
+            section_bytes.add(sauerkraut::stats::BYTES_GLOBALS);
 
             auto f_locals_ser = (NULL != obj.f_locals) ? 
-                std::optional{po_serializer.serialize(builder, obj.f_locals)} : std::nullopt;
-
-            auto fast_locals_result = serialize_fast_locals_plus(builder, obj, ser_args);
-            auto stack_ser = serialize_stack(builder, obj, stack_depth);
+                std::optional{serialize_slot(builder, obj.f_locals, shared)} : std::nullopt;
+
+            auto fast_locals_result = serialize_fast_locals_plus(builder, obj, ser_args, shared);
+            section_bytes.add(sauerkraut::stats::BYTES_LOCALS);
+            auto stack_ser = serialize_stack(builder, obj, stack_depth, shared);
+            section_bytes.add(sauerkraut::stats::BYTES_STACK);
+            // In a batch, frames of the same module share these.
+            auto create_string = [&](const std::string &value) {
+                return ser_args.batch ? builder.CreateSharedString(value) : builder.CreateString(value);
+            };
             auto module_name_ser = ser_args.module_name ?
-                std::optional{builder.CreateString(ser_args.module_name.value())} : std::nullopt;
+                std::optional{create_string(ser_args.module_name.value())} : std::nullopt;
             auto module_package_ser = ser_args.module_package ?
-                std::optional{builder.CreateString(ser_args.module_package.value())} : std::nullopt;
+                std::optional{create_string(ser_args.module_package.value())} : std::nullopt;
             auto module_filename_ser = ser_args.module_filename ?
-                std::optional{builder.CreateString(ser_args.module_filename.value())} : std::nullopt;
+                std::optional{create_string(ser_args.module_filename.value())} : std::nullopt;
             auto module_source_ser = ser_args.module_source ?
-                std::optional{builder.CreateVector(ser_args.module_source.value())} : std::nullopt;
+                std::optional{serialize_module_source(builder, ser_args.module_source.value(), ser_args)} : std::nullopt;
+            section_bytes.add(sauerkraut::stats::BYTES_MODULE);
 
             pyframe_buffer::PyInterpreterFrameBuilder frame_builder(builder);
 
@@ -672,12 +1396,19 @@ namespace serdes {
             if (module_source_ser) {
                 frame_builder.add_module_source(module_source_ser.value());
             }
+            if (shared_ser) {
+                frame_builder.add_shared_objects(shared_ser.value());
+            }
 
             return frame_builder.Finish();
 
         }
 
-        DeserializedPyInterpreterFrame deserialize(const pyframe_buffer::PyInterpreterFrame *obj, bool reconstruct_module=true) {
+        // bases holds the frames a delta was taken against, oldest first.
+        // batch is set when obj belongs to a PyFrameBatch.
+        DeserializedPyInterpreterFrame deserialize(const pyframe_buffer::PyInterpreterFrame *obj, bool reconstruct_module=true,
+                                                   const std::vector<const pyframe_buffer::PyInterpreterFrame*> &bases = {},
+                                                   BatchReadContext *batch = nullptr) {
             DeserializedPyInterpreterFrame deser;
             if (obj->module_name()) {
                 deser.module_name = std::string(obj->module_name()->c_str(), obj->module_name()->size());
@@ -688,7 +1419,9 @@ namespace serdes {
             if (obj->module_filename()) {
                 deser.module_filename = std::string(obj->module_filename()->c_str(), obj->module_filename()->size());
             }
-            if (reconstruct_module && obj->module_source()) {
+            bool bootstrapped = batch != nullptr && obj->module_source() &&
+                !batch->bootstrapped_sources.insert(obj->module_source()).second;
+            if (reconstruct_module && obj->module_source() && !bootstrapped) {
                 if (!bootstrap_module_globals(obj)) {
                     if (!PyErr_Occurred()) {
                         PyErr_SetString(PyExc_RuntimeError, "Failed to reconstruct module source during frame deserialization.");
@@ -699,14 +1432,27 @@ namespace serdes {
             if(obj->f_executable()) {
                 deser.f_executable = code_serializer.deserialize(obj->f_executable());
             }
+
+            pyobject_strongref shared;
+            if(obj->shared_objects()) {
+                shared = po_serializer.deserialize(obj->shared_objects());
+                if (!shared) {
+                    return deser;
+                }
+                if (!PyList_Check(shared.borrow())) {
+                    PyErr_SetString(PyExc_ValueError, "Serialized frame has a malformed shared object table.");
+                    return deser;
+                }
+            }
+
             if(obj->f_funcobj()) {
-                deser.f_funcobj = po_serializer.deserialize(obj->f_funcobj());
+                deser.f_funcobj = deserialize_slot(obj->f_funcobj(), shared.borrow(), batch);
             }
             if(obj->f_globals()) {
-                deser.f_globals = po_serializer.deserialize_dill(obj->f_globals());
+                deser.f_globals = deserialize_globals(obj->f_globals(), batch);
             }
             deser.f_builtins = po_serializer.deserialize(obj->f_builtins());
-            deser.f_locals = po_serializer.deserialize(obj->f_locals());
+            deser.f_locals = deserialize_slot(obj->f_locals(), shared.borrow(), batch);
 
             deser.instr_offset = obj->instr_offset();
             deser.return_offset = obj->return_offset();
@@ -722,6 +1468,12 @@ namespace serdes {
             int total_locals = exclusion_bitmask->size();
             deser.localsplus.reserve(total_locals);
 
+            std::vector<std::vector<const pyframe_buffer::PyObject*>> base_slots;
+            base_slots.reserve(bases.size());
+            for (auto base : bases) {
+                base_slots.push_back(local_slots(base));
+            }
+
             int localsplus_idx = 0;
             for(int i = 0; i < total_locals; i++) {
                 if(exclusion_bitmask->Get(i) != 0) {
@@ -729,7 +1481,12 @@ namespace serdes {
                     deser.localsplus.push_back(Py_None);
                 } else {
                     // This local was included, get it from the serialized data
-                    deser.localsplus.push_back(po_serializer.deserialize(localsplus->Get(localsplus_idx++)));
+                    auto local = localsplus->Get(localsplus_idx++);
+                    if (local->in_base()) {
+                        deser.localsplus.push_back(deserialize_from_base(local, i, base_slots));
+                    } else {
+                        deser.localsplus.push_back(deserialize_slot(local, shared.borrow(), batch));
+                    }
                 }
             }
 
@@ -740,7 +1497,7 @@ namespace serdes {
             }
             deser.stack.reserve(stack->size());
             for(auto stack_obj : *stack) {
-                deser.stack.push_back(po_serializer.deserialize(stack_obj));
+                deser.stack.push_back(deserialize_slot(stack_obj, shared.borrow(), batch));
             }
 
             return deser;
@@ -775,44 +1532,75 @@ namespace serdes {
                 PyInterpreterFrameSerdes interpreter_frame_serializer(po_serializer);
                 auto stack_size = utils::py::get_stack_state((PyObject*)&obj).size();
                 auto interp_frame_offset = interpreter_frame_serializer.serialize(builder, *obj.f_frame, stack_size, ser_args);
+                if (PyErr_Occurred()) {
+                    return 0;
+                }
+
+                auto f_trace_ser = (NULL != obj.f_trace) ?
+                    std::optional{po_serializer.serialize(builder, obj.f_trace)} : std::nullopt;
+                auto f_extra_locals_ser = (NULL != obj.f_extra_locals) ?
+                    std::optional{po_serializer.serialize(builder, obj.f_extra_locals)} : std::nullopt;
+                auto f_locals_cache_ser = (NULL != obj.f_locals_cache) ?
+                    std::optional{po_serializer.serialize(builder, obj.f_locals_cache)} : std::nullopt;
+
+                // Everything that can produce out-of-band buffers has been
+                // serialized at this point.
+                // In a batch the sizes are recorded once for all frames.
+                std::optional<flatbuffers::Offset<flatbuffers::Vector<uint64_t>>> oob_buffer_sizes_ser = std::nullopt;
+                auto oob_buffer_sizes = ser_args.batch ? std::vector<uint64_t>{} : po_serializer.out_of_band_sizes();
+                if(!oob_buffer_sizes.empty()) {
+                    oob_buffer_sizes_ser = builder.CreateVector(oob_buffer_sizes);
+                }
 
                 pyframe_buffer::PyFrameBuilder frame_builder(builder);
+                if(ser_args.incremental) {
+                    frame_builder.add_checkpoint_id(new_checkpoint_id());
+                    if(ser_args.delta_base) {
+                        frame_builder.add_base_id(ser_args.delta_base->checkpoint_id);
+                    }
+                }
                 // Do NOT serialize the ob_base.
                 // frame_builder.add_ob_base(poh_serializer.serialize(builder, &obj.ob_base));
 
                 frame_builder.add_f_frame(interp_frame_offset);
-                
-                // TODO: These need to be changed to serialize BEFORE
-                // creating the frame_builder.
-                if(NULL != obj.f_trace) {
-                    auto f_trace_ser = po_serializer.serialize(builder, obj.f_trace);
-                    frame_builder.add_f_trace(f_trace_ser);
+
+                if(f_trace_ser) {
+                    frame_builder.add_f_trace(f_trace_ser.value());
                 }
 
                 frame_builder.add_f_lineno(obj.f_lineno);
                 frame_builder.add_f_trace_lines(obj.f_trace_lines);
                 frame_builder.add_f_trace_opcodes(obj.f_trace_opcodes);
 
-                if(NULL != obj.f_extra_locals) {
-                    auto f_extra_locals_ser = po_serializer.serialize(builder, obj.f_extra_locals);
-                    frame_builder.add_f_extra_locals(f_extra_locals_ser);
+                if(f_extra_locals_ser) {
+                    frame_builder.add_f_extra_locals(f_extra_locals_ser.value());
                 }
 
-                if(NULL != obj.f_locals_cache) {
-                    auto f_locals_cache_ser = po_serializer.serialize(builder, obj.f_locals_cache);
-                    frame_builder.add_f_locals_cache(f_locals_cache_ser);
+                if(f_locals_cache_ser) {
+                    frame_builder.add_f_locals_cache(f_locals_cache_ser.value());
+                }
+
+                if(oob_buffer_sizes_ser) {
+                    frame_builder.add_oob_buffer_sizes(oob_buffer_sizes_ser.value());
                 }
 
-                
                 return frame_builder.Finish();
             }
 
-            DeserializedPyFrame deserialize(const pyframe_buffer::PyFrame *obj, bool reconstruct_module=true) {
+            // For a delta, bases holds the frames it builds on, oldest first.
+            DeserializedPyFrame deserialize(const pyframe_buffer::PyFrame *obj, bool reconstruct_module=true,
+                                            const std::vector<const pyframe_buffer::PyFrame*> &bases = {},
+                                            BatchReadContext *batch = nullptr) {
                 // auto ob_base_deser = poh_serializer.deserialize(obj->ob_base());
                 DeserializedPyFrame deser;
                 PyInterpreterFrameSerdes interpreter_frame_serializer(po_serializer);
 
-                deser.f_frame = interpreter_frame_serializer.deserialize(obj->f_frame(), reconstruct_module);
+                std::vector<const pyframe_buffer::PyInterpreterFrame*> base_frames;
+                base_frames.reserve(bases.size());
+                for (auto base : bases) {
+                    base_frames.push_back(base->f_frame());
+                }
+                deser.f_frame = interpreter_frame_serializer.deserialize(obj->f_frame(), reconstruct_module, base_frames, batch);
 
                 deser.f_trace = po_serializer.deserialize(obj->f_trace());
 
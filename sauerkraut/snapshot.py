@@ -0,0 +1,126 @@
+"""Background snapshots: serializing a frame in a forked child.
+
+``copy_current_frame(serialize=True, background=True, path=...)`` (and the
+same arguments to ``copy_frame`` and ``copy_frame_from_greenlet``) fork the
+process.  The child sees the parent's memory as it was at the fork, shared
+copy-on-write by the kernel, so it can serialize the frame and write it to
+``path`` while the parent keeps running.  The parent gets a
+``BackgroundSnapshot`` right away:
+
+    snapshot = sauerkraut.copy_current_frame(serialize=True, background=True,
+                                             path="checkpoint.bin")
+    ...
+    snapshot.wait()
+
+The child writes to a temporary file next to ``path`` and renames it into
+place, so ``path`` only ever holds a complete frame.  Frames serialized
+with ``out_of_band=True`` are written with ``write_frame``.
+
+A snapshot that is dropped before its child exits hands the child's pid
+to ``_active``, and the next snapshot reaps it, the way ``subprocess``
+reaps abandoned children.
+"""
+
+import os
+import tempfile
+
+from .frame_io import write_frame
+
+
+class SnapshotError(RuntimeError):
+    """The child writing a background snapshot failed."""
+
+
+# Pids of children whose snapshots were dropped while they still ran.
+_active = []
+
+
+def _cleanup():
+    """Reap the children in ``_active`` that have exited."""
+    for pid in _active[:]:
+        try:
+            reaped, _ = os.waitpid(pid, os.WNOHANG)
+        except ChildProcessError:
+            # Reaped by someone else.
+            reaped = pid
+        if reaped:
+            try:
+                _active.remove(pid)
+            except ValueError:
+                pass
+
+
+class BackgroundSnapshot:
+    def __init__(self, pid, path):
+        self.pid = pid
+        self.path = os.fspath(path)
+        self._status = None
+        _cleanup()
+
+    def poll(self):
+        """Whether the child has finished, without blocking."""
+        if self._status is None:
+            pid, status = os.waitpid(self.pid, os.WNOHANG)
+            if pid == 0:
+                return False
+            self._status = os.waitstatus_to_exitcode(status)
+        return True
+
+    @property
+    def done(self):
+        return self.poll()
+
+    def wait(self):
+        """Wait for the child and return the path of the snapshot.
+
+        Raises SnapshotError if the child failed; its traceback went to
+        stderr.
+        """
+        if self._status is None:
+            _, status = os.waitpid(self.pid, 0)
+            self._status = os.waitstatus_to_exitcode(status)
+        if self._status != 0:
+            raise SnapshotError(f"background snapshot of {self.path} failed with status {self._status}")
+        return self.path
+
+    def __del__(self, _waitpid=os.waitpid, _WNOHANG=os.WNOHANG, _active=_active):
+        # Default arguments keep what this needs alive at shutdown.
+        if getattr(self, "_status", 0) is not None:
+            return
+        try:
+            pid, _ = _waitpid(self.pid, _WNOHANG)
+        except ChildProcessError:
+            return
+        if pid == 0:
+            _active.append(self.pid)
+
+    def __repr__(self):
+        if self._status is None:
+            state = "running"
+        else:
+            state = f"exited {self._status}"
+        return f"<BackgroundSnapshot pid={self.pid} path={self.path!r} {state}>"
+
+
+def _write_snapshot(path, serialized):
+    """Called in the child with what copy_*_frame(serialize=True) returned."""
+    path = os.fspath(path)
+    if isinstance(serialized, tuple):
+        frame, buffers = serialized
+    else:
+        frame, buffers = serialized, ()
+    directory = os.path.dirname(os.path.abspath(path))
+    fd, tmp_path = tempfile.mkstemp(dir=directory, suffix=".tmp")
+    try:
+        with os.fdopen(fd, "wb") as f:
+            if buffers:
+                write_frame(f, frame, buffers)
+            else:
+                f.write(frame)
+        os.replace(tmp_path, path)
+    except BaseException:
+        try:
+            os.unlink(tmp_path)
+        except FileNotFoundError:
+            pass
+        raise
@@ -168,7 +168,7 @@ class CMakeBuild(build_ext):
             self.copy_file(main_src, dst)
 
         # Copy helper libraries
-        for lib_name in ["greenlet_compat", "serdes"]:
+        for lib_name in ["greenlet_compat", "serdes", "checkpoint_writer"]:
             src = os.path.join(build_temp, f"{lib_name}{helper_ext}")
             if os.path.exists(src):
                 target_name = f"{lib_name}{helper_target_ext}"
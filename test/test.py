@@ -1,5 +1,7 @@
 import sauerkraut as skt
 from sauerkraut import liveness
+import contextlib
+import gc
 import greenlet
 import numpy as np
 import importlib
@@ -8,6 +10,7 @@ import subprocess
 import sys
 import tempfile
 import textwrap
+import time
 import uuid
 
 calls = 0
@@ -142,6 +145,648 @@ def test_greenlet():
     print("Test 'greenlet' passed")
 
 
+def out_of_band_fn(c):
+    a = np.arange(1 << 16, dtype=np.float64)
+    greenlet.getcurrent().parent.switch()
+    a += c
+    return float(a.sum())
+
+
+def test_out_of_band_buffers():
+    gr = greenlet.greenlet(out_of_band_fn)
+    gr.switch(2)
+    serframe, buffers = skt.copy_frame_from_greenlet(
+        gr, serialize=True, out_of_band=True
+    )
+    assert len(buffers) == 1
+    assert buffers[0].nbytes == (1 << 16) * 8
+    # The array data travels next to the frame, not inside it.
+    assert len(serframe) < buffers[0].nbytes
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        path = os.path.join(tmpdir, "frame.bin")
+        skt.write_frame(path, serframe, buffers)
+        frame_bytes, frame_buffers = skt.read_frame(path)
+        code = skt.deserialize_frame(frame_bytes, buffers=frame_buffers)
+        gr2 = greenlet.greenlet(skt.run_frame)
+        result = gr2.switch(code)
+    expected = float((np.arange(1 << 16, dtype=np.float64) + 2).sum())
+    assert result == expected
+
+    try:
+        skt.deserialize_frame(serframe)
+    except ValueError:
+        pass
+    else:
+        assert False, "deserializing without the out-of-band buffers should fail"
+    print("Test 'out_of_band_buffers' passed")
+
+
+def test_serialize_into_buffer():
+    gr = greenlet.greenlet(resume_greenlet_fn)
+    gr.switch(10)
+    out = bytearray(1 << 16)
+    serframe = skt.copy_frame_from_greenlet(gr, serialize=True, out=out)
+    assert isinstance(serframe, memoryview)
+    assert serframe.obj is out
+    result = skt.deserialize_frame(serframe, run=True)
+    assert result == 15
+
+    try:
+        skt.copy_frame_from_greenlet(gr, serialize=True, out=bytearray(16))
+    except ValueError:
+        pass
+    else:
+        assert False, "serializing into a buffer that is too small should fail"
+
+    serframe = skt.copy_frame_from_greenlet(gr, serialize=True)
+    assert skt.deserialize_frame(bytes(serframe), run=True) == 15
+    print("Test 'serialize_into_buffer' passed")
+
+
+def test_deserialize_from_buffers():
+    gr = greenlet.greenlet(resume_greenlet_fn)
+    gr.switch(10)
+    serframe = skt.copy_frame_from_greenlet(gr, serialize=True)
+
+    as_array = np.frombuffer(serframe, dtype=np.uint8)
+    assert skt.deserialize_frame(as_array, run=True) == 15
+    assert skt.deserialize_frame(bytearray(serframe), run=True) == 15
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        path = os.path.join(tmpdir, "frame.bin")
+        with open(path, "wb") as f:
+            f.write(serframe)
+        assert skt.deserialize_frame_from_file(path, run=True) == 15
+    print("Test 'deserialize_from_buffers' passed")
+
+
+class _IntSubclass(int):
+    pass
+
+
+def native_values_fn(c):
+    i = 7
+    big = 1 << 80
+    f = 2.5
+    t = True
+    n = None
+    s = "sauerkraut \u00e9"
+    b = b"\x00\x01"
+    tup = (1, 2.0, ("x", None), b"y")
+    sub = _IntSubclass(3)
+    greenlet.getcurrent().parent.switch()
+    return [c, i, big, f, t, n, s, b, tup, sub]
+
+
+def test_native_values():
+    gr = greenlet.greenlet(native_values_fn)
+    gr.switch(11)
+    serframe = skt.copy_frame_from_greenlet(gr, serialize=True)
+    result = skt.deserialize_frame(serframe, run=True)
+    expected = [
+        11, 7, 1 << 80, 2.5, True, None, "sauerkraut \u00e9", b"\x00\x01",
+        (1, 2.0, ("x", None), b"y"), 3,
+    ]
+    assert result == expected
+    assert [type(v) for v in result] == [type(v) for v in expected[:-1]] + [_IntSubclass]
+    print("Test 'native_values' passed")
+
+
+def shared_objects_fn(c):
+    data = [c, 2, 3]
+    alias = data
+    it = iter(data)
+    next(it)
+    greenlet.getcurrent().parent.switch()
+    data.append(4)
+    return alias is data, list(it)
+
+
+def test_shared_objects():
+    gr = greenlet.greenlet(shared_objects_fn)
+    gr.switch(1)
+    serframe = skt.copy_frame_from_greenlet(gr, serialize=True)
+    result = skt.deserialize_frame(serframe, run=True)
+    assert result == (True, [2, 3, 4])
+    print("Test 'shared_objects' passed")
+
+
+def compression_fn(c):
+    values = [7] * 20000
+    greenlet.getcurrent().parent.switch()
+    return sum(values) + c
+
+
+def test_compression():
+    gr = greenlet.greenlet(compression_fn)
+    gr.switch(1)
+    plain = skt.copy_frame_from_greenlet(gr, serialize=True)
+    for codec in skt.compression_codecs():
+        serframe = skt.copy_frame_from_greenlet(gr, serialize=True, compression=codec)
+        assert len(serframe) < len(plain), codec
+        result = skt.deserialize_frame(serframe, run=True)
+        assert result == 140001
+    print("Test 'compression' passed")
+
+
+def compression_native_fn(c):
+    text = "sauerkraut " * 4000
+    data = b"\x00" * 40000
+    greenlet.getcurrent().parent.switch()
+    return len(text) + len(data) + c
+
+
+def test_compression_native():
+    gr = greenlet.greenlet(compression_native_fn)
+    gr.switch(1)
+    plain = skt.copy_frame_from_greenlet(gr, serialize=True)
+    for codec in skt.compression_codecs():
+        serframe = skt.copy_frame_from_greenlet(gr, serialize=True, compression=codec)
+        assert len(serframe) < len(plain) // 4, codec
+        result = skt.deserialize_frame(serframe, run=True)
+        assert result == 84001
+    if "zstd" in skt.compression_codecs():
+        serframe = skt.copy_frame_from_greenlet(gr, serialize=True, compression="zstd", compression_level=-1)
+        assert len(serframe) < len(plain) // 4
+        assert skt.deserialize_frame(serframe, run=True) == 84001
+    print("Test 'compression_native' passed")
+
+
+def delta_fn(c):
+    big = list(range(50000))
+    counter = 0
+    while counter < 3:
+        counter += 1
+        greenlet.getcurrent().parent.switch()
+    return len(big) + counter + c
+
+
+def test_delta_checkpoints():
+    gr = greenlet.greenlet(delta_fn)
+    gr.switch(1)
+    base = bytes(skt.copy_frame_from_greenlet(gr, serialize=True, incremental=True))
+    gr.switch()
+    delta = bytes(skt.copy_frame_from_greenlet(gr, serialize=True, base=base))
+    assert len(delta) * 4 < len(base)
+    gr.switch()
+    delta2 = bytes(skt.copy_frame_from_greenlet(gr, serialize=True, base=delta))
+
+    result = skt.deserialize_frame([base, delta, delta2], run=True)
+    assert result == 50004
+    try:
+        skt.deserialize_frame(delta2)
+        assert False, "a delta needs its base"
+    except ValueError:
+        pass
+    try:
+        skt.deserialize_frame([base, delta2])
+        assert False, "the chain is broken"
+    except ValueError:
+        pass
+    print("Test 'delta_checkpoints' passed")
+
+
+def test_repeated_serialization():
+    # Later frames start from the size learned from earlier ones and reuse
+    # the memory of frames that were freed.
+    gr = greenlet.greenlet(compression_fn)
+    gr.switch(2)
+    sizes = set()
+    for kwargs in ({}, {}, {}, {"sizehint": 16}, {}):
+        serframe = skt.copy_frame_from_greenlet(gr, serialize=True, **kwargs)
+        sizes.add(len(serframe))
+        assert skt.deserialize_frame(serframe, run=True) == 140002
+        del serframe
+    assert len(sizes) == 1
+    print("Test 'repeated_serialization' passed")
+
+
+def batch_fn(shared, c):
+    local = [c] * 100
+    greenlet.getcurrent().parent.switch()
+    shared.append(c)
+    return shared, sum(local)
+
+
+def test_serialize_frames():
+    shared = [0]
+    greenlets = [greenlet.greenlet(batch_fn) for _ in range(4)]
+    for i, gr in enumerate(greenlets):
+        gr.switch(shared, i)
+    separate = sum(len(skt.copy_frame_from_greenlet(gr, serialize=True)) for gr in greenlets)
+    batch = skt.serialize_frames(greenlets)
+    assert len(batch) < separate
+
+    frames = skt.deserialize_frames(batch)
+    assert len(frames) == 4
+    results = [skt.run_frame(frame) for frame in frames]
+    # The list all four greenlets shared is still a single list.
+    assert results[0][0] is results[3][0]
+    assert results[0][0] == [0, 0, 1, 2, 3]
+    assert [result[1] for result in results] == [0, 100, 200, 300]
+    print("Test 'serialize_frames' passed")
+
+
+def make_add_step():
+    def step(c):
+        a = 1
+        greenlet.getcurrent().parent.switch()
+        return a + c
+    return step
+
+
+def make_mul_step():
+    def step(c):
+        a = 2
+        greenlet.getcurrent().parent.switch()
+        return a * c
+    return step
+
+
+def test_same_name_immutables():
+    # Both functions are called 'step'; the immutables cache must not mix them up.
+    add_step = make_add_step()
+    mul_step = make_mul_step()
+    serframes = []
+    for fn in (add_step, mul_step):
+        gr = greenlet.greenlet(fn)
+        gr.switch(10)
+        serframes.append(skt.copy_frame_from_greenlet(gr, serialize=True, exclude_immutables=True))
+    results = [skt.deserialize_frame(serframe, run=True) for serframe in serframes]
+    assert results == [11, 20]
+    print("Test 'same_name_immutables' passed")
+
+
+def test_immutables_outlive_function():
+    # The code cache keeps the function alive, so a frame that left out its
+    # immutables can be restored after the function itself is gone.
+    def make_step():
+        def step(c):
+            a = 3
+            greenlet.getcurrent().parent.switch()
+            return a * c + 1
+        return step
+
+    step = make_step()
+    gr = greenlet.greenlet(step)
+    gr.switch(10)
+    serframe = skt.copy_frame_from_greenlet(gr, serialize=True, exclude_immutables=True)
+    del gr, step
+    gc.collect()
+    assert skt.deserialize_frame(serframe, run=True) == 31
+
+    assert skt.set_weak_code_cache(True) is False
+    assert skt.set_weak_code_cache(False) is True
+    print("Test 'immutables_outlive_function' passed")
+
+
+def handler_liveness_fn(c):
+    saved = c * 2
+    dead = [c] * 1000
+    len(dead)
+    try:
+        greenlet.getcurrent().parent.switch()
+        raise ValueError
+    except ValueError:
+        return saved
+
+
+def test_dead_locals_liveness():
+    gr = greenlet.greenlet(handler_liveness_fn)
+    gr.switch(21)
+    serframe = skt.copy_frame_from_greenlet(gr, serialize=True)
+    full = skt.copy_frame_from_greenlet(gr, serialize=True, exclude_dead_locals=False)
+    # 'dead' is never read again, but 'saved' is read by the handler.
+    assert len(serframe) < len(full)
+    assert skt.deserialize_frame(serframe, run=True) == 42
+    print("Test 'dead_locals_liveness' passed")
+
+
+def with_block_fn(c):
+    total = 0
+    with contextlib.nullcontext(c) as base:
+        for i in range(3):
+            if i == 1:
+                greenlet.getcurrent().parent.switch()
+            total += base + i
+    return total
+
+
+def test_stack_depth_with_block():
+    # The with block keeps its exit on the stack below the loop's iterator.
+    gr = greenlet.greenlet(with_block_fn)
+    gr.switch(10)
+    serframe = skt.copy_frame_from_greenlet(gr, serialize=True)
+    assert skt.deserialize_frame(serframe, run=True) == 33
+    print("Test 'stack_depth_with_block' passed")
+
+
+def selective_snapshot_fn(c):
+    data = {"count": c}
+    label = ("count", 1)
+    greenlet.getcurrent().parent.switch()
+    data[label[0]] += label[1]
+    return data["count"]
+
+
+def test_selective_snapshot():
+    gr = greenlet.greenlet(selective_snapshot_fn)
+    gr.switch(10)
+    try:
+        skt.copy_frame_from_greenlet(gr, snapshot="shallow")
+    except ValueError:
+        pass
+    else:
+        assert False, "unknown snapshot mode was accepted"
+    snapshot = skt.copy_frame_from_greenlet(gr, snapshot="selective")
+    # The original updates its dict in place; the snapshot has its own.
+    assert gr.switch() == 11
+    serframe = skt.serialize_frame(snapshot)
+    assert skt.deserialize_frame(serframe, run=True) == 11
+    print("Test 'selective_snapshot' passed")
+
+
+def test_background_snapshot():
+    gr = greenlet.greenlet(resume_greenlet_fn)
+    gr.switch(10)
+    with tempfile.TemporaryDirectory() as tmpdir:
+        path = os.path.join(tmpdir, "snapshot.bin")
+        snapshot = skt.copy_frame_from_greenlet(gr, serialize=True, background=True, path=path)
+        # The child serializes the frame as it was at the fork.
+        assert gr.switch() == 15
+        assert snapshot.wait() == path
+        assert snapshot.done
+        assert skt.deserialize_frame_from_file(path, run=True) == 15
+
+        # A snapshot dropped while its child runs leaves the child to be
+        # reaped by later snapshots instead of lingering as a zombie.
+        from sauerkraut import snapshot as snapshot_module
+        gr = greenlet.greenlet(resume_greenlet_fn)
+        gr.switch(10)
+        dropped = skt.copy_frame_from_greenlet(gr, serialize=True, background=True, path=path)
+        pid = dropped.pid
+        del dropped
+        deadline = time.monotonic() + 10
+        while True:
+            snapshot_module._cleanup()
+            if pid not in snapshot_module._active or time.monotonic() > deadline:
+                break
+            time.sleep(0.01)
+        try:
+            os.waitpid(pid, os.WNOHANG)
+        except ChildProcessError:
+            pass
+        else:
+            assert False, "a dropped snapshot's child was not reaped"
+    print("Test 'background_snapshot' passed")
+
+
+def test_checkpoint_writer():
+    gr = greenlet.greenlet(resume_greenlet_fn)
+    gr.switch(10)
+    with tempfile.TemporaryDirectory() as tmpdir:
+        paths = [os.path.join(tmpdir, f"checkpoint{i}.bin") for i in range(3)]
+        with skt.CheckpointWriter(fsync_batch=2) as writer:
+            for path in paths:
+                writer.submit(path, skt.copy_frame_from_greenlet(gr, serialize=True))
+            writer.flush()
+            assert writer.pending == 0
+        assert sorted(os.listdir(tmpdir)) == sorted(os.path.basename(path) for path in paths)
+        for path in paths:
+            assert skt.deserialize_frame_from_file(path, run=True) == 15
+
+        # Frames for the same path in one batch are written in turn.
+        path = os.path.join(tmpdir, "same.bin")
+        with skt.CheckpointWriter(fsync_batch=3) as writer:
+            writer.submit(path, b"first")
+            writer.submit(path, b"second")
+            writer.submit(path, b"third")
+            writer.flush()
+        with open(path, "rb") as f:
+            assert f.read() == b"third"
+        os.unlink(path)
+
+        writer = skt.CheckpointWriter()
+        writer.submit(os.path.join(tmpdir, "missing", "checkpoint.bin"), b"frame")
+        try:
+            writer.flush()
+        except FileNotFoundError:
+            pass
+        else:
+            assert False, "a failed write was not reported"
+        writer.close()
+    print("Test 'checkpoint_writer' passed")
+
+
+def test_aligned_checkpoint():
+    gr = greenlet.greenlet(resume_greenlet_fn)
+    gr.switch(10)
+    frame = skt.copy_frame_from_greenlet(gr, serialize=True, aligned=True)
+    assert len(frame) % 4096 == 0
+    assert np.frombuffer(frame, dtype=np.uint8).ctypes.data % 4096 == 0
+    unaligned = skt.copy_frame_from_greenlet(gr, serialize=True)
+
+    # Temporary directories are often on tmpfs, which has no O_DIRECT.
+    with tempfile.TemporaryDirectory(dir=os.path.dirname(os.path.abspath(__file__))) as tmpdir:
+        path = os.path.join(tmpdir, "aligned.bin")
+        with skt.CheckpointWriter(direct=True) as writer:
+            writer.submit(path, frame)
+            writer.flush()
+            if writer.direct_writes > 0:
+                assert writer.bounced_bytes == 0
+                writer.submit(os.path.join(tmpdir, "unaligned.bin"), unaligned)
+                writer.flush()
+                assert writer.bounced_bytes > 0
+        assert skt.deserialize_frame_from_file(path, run=True) == 15
+
+    try:
+        skt.copy_frame_from_greenlet(gr, serialize=True, aligned=True, out=bytearray(1 << 16))
+    except ValueError:
+        pass
+    else:
+        assert False, "aligned=True was accepted together with out="
+    print("Test 'aligned_checkpoint' passed")
+
+
+def test_checkpoint_archive():
+    with tempfile.TemporaryDirectory() as tmpdir:
+        path = os.path.join(tmpdir, "run.skar")
+        greenlets = {}
+        with skt.ArchiveWriter(path) as archive:
+            for c in (10, 20):
+                gr = greenlet.greenlet(resume_greenlet_fn)
+                gr.switch(c)
+                greenlets[f"worker-{c}"] = gr
+                for generation in range(2):
+                    frame = skt.copy_frame_from_greenlet(gr, serialize=True)
+                    assert archive.append(f"worker-{c}", frame) == generation
+        # Reopening appends after the existing records.
+        with skt.ArchiveWriter(path) as archive:
+            assert archive.append("worker-10", skt.copy_frame_from_greenlet(greenlets["worker-10"], serialize=True)) == 2
+
+        with skt.ArchiveReader(path) as reader:
+            assert sorted(reader.keys()) == ["worker-10", "worker-20"]
+            assert reader.generations("worker-10") == [0, 1, 2]
+            assert reader.deserialize("worker-10", run=True) == 15
+            assert reader.deserialize("worker-20", generation=0, run=True) == 25
+    print("Test 'checkpoint_archive' passed")
+
+
+def _abandon_archive(archive):
+    # Close without writing the index, as if the writer had died.
+    os.close(archive._fd)
+    archive._fd = None
+
+
+def test_archive_recovery():
+    with tempfile.TemporaryDirectory() as tmpdir:
+        path = os.path.join(tmpdir, "run.skar")
+        archive = skt.ArchiveWriter(path, alignment=256)
+        for i in range(3):
+            archive.append("key", bytes([i]) * 1000)
+        _abandon_archive(archive)
+
+        # The alignment is stored in the archive, so recovery does not
+        # depend on the reader's defaults.
+        with skt.ArchiveReader(path) as reader:
+            assert reader.alignment == 256
+            assert reader.generations("key") == [0, 1, 2]
+            assert bytes(reader.latest("key")) == bytes([2]) * 1000
+        try:
+            skt.ArchiveWriter(path, alignment=64)
+        except ValueError:
+            pass
+        else:
+            assert False, "an archive was reopened with a different alignment"
+
+        # A torn last record is dropped.
+        size = os.path.getsize(path)
+        os.truncate(path, size - 100)
+        with skt.ArchiveWriter(path) as archive:
+            assert archive.append("key", b"new") == 2
+        with skt.ArchiveReader(path) as reader:
+            assert reader.generations("key") == [0, 1, 2]
+            assert bytes(reader.latest("key")) == b"new"
+
+        # A damaged record in the middle is reported, not cut off.
+        archive = skt.ArchiveWriter(path)
+        _abandon_archive(archive)
+        with skt.ArchiveReader(path) as reader:
+            offset = reader._index["key"][0].offset
+        with open(path, "r+b") as f:
+            f.seek(offset)
+            f.write(b"\xff")
+        size = os.path.getsize(path)
+        try:
+            skt.ArchiveWriter(path)
+        except ValueError:
+            pass
+        else:
+            assert False, "a corrupt record was dropped silently"
+        assert os.path.getsize(path) == size
+    print("Test 'archive_recovery' passed")
+
+
+def test_peek_frame():
+    gr = greenlet.greenlet(resume_greenlet_fn)
+    gr.switch(10)
+    frame = skt.copy_frame_from_greenlet(gr, serialize=True)
+    header = skt.peek_frame(frame)
+    assert header["name"] == "resume_greenlet_fn"
+    assert header["qualname"] == "resume_greenlet_fn"
+    assert header["module"] == __name__
+    assert header["code_hash"] == skt.code_hash(resume_greenlet_fn)
+    assert header["size"] == len(frame)
+    assert header["instr_offset"] > 0
+    assert not header["incremental"]
+
+    frame, buffers = skt.copy_frame_from_greenlet(gr, serialize=True, out_of_band=True)
+    assert skt.peek_frame(frame)["buffers"] == len(buffers)
+
+    try:
+        skt.peek_frame(b"not a frame" * 8)
+    except ValueError:
+        pass
+    else:
+        assert False, "peek_frame accepted a buffer without a frame header"
+    print("Test 'peek_frame' passed")
+
+
+def test_stats():
+    skt.stats(reset=True, enable=True)
+    gr = greenlet.greenlet(resume_greenlet_fn)
+    gr.switch(10)
+    frame = skt.copy_frame_from_greenlet(gr, serialize=True)
+    assert skt.deserialize_frame(frame, run=True) == 15
+    stats = skt.stats(reset=True, enable=False)
+    assert stats["enabled"]
+    counters = stats["counters"]
+    assert counters["frames_serialized"] == 1
+    assert counters["frames_deserialized"] == 1
+    assert counters["bytes_frame"] == len(frame)
+    assert counters["bytes_locals"] > 0
+    assert counters["liveness_cache_hits"] + counters["liveness_cache_misses"] >= 1
+    assert stats["timers"]["serialize"]["calls"] == 1
+    assert stats["timers"]["serialize"]["ns"] > 0
+
+    # Disabled stats stay at zero.
+    skt.copy_frame_from_greenlet(gr, serialize=True)
+    stats = skt.stats()
+    assert not stats["enabled"]
+    assert stats["counters"]["frames_serialized"] == 0
+    print("Test 'stats' passed")
+
+
+def report_fn(c):
+    big = np.zeros(10000)
+    small = 3
+    unused = "dead after the switch"
+    greenlet.getcurrent().parent.switch()
+    return big.sum() + small + c
+
+
+def test_frame_report():
+    gr = greenlet.greenlet(report_fn)
+    gr.switch(1)
+    frame, report = skt.copy_frame_from_greenlet(gr, serialize=True, report=True)
+    assert isinstance(report, skt.FrameReport)
+    assert report.frame_size == len(frame)
+    locals_by_name = {entry.name: entry for entry in report if entry.section == "local"}
+    assert locals_by_name["big"].type == "ndarray"
+    assert locals_by_name["big"].size > 80000
+    assert locals_by_name["unused"].excluded
+    assert report.largest(1)[0].name == "big"
+    assert report.by_section()["code"][0] > 0
+
+    analyzed = skt.analyze_frame(frame)
+    assert analyzed.frame_size == len(frame)
+    assert [entry.name for entry in analyzed if entry.section == "local"] == list(locals_by_name)
+    assert analyzed.largest(1)[0].name == "big"
+    assert "big" in str(analyzed)
+
+    copied, report = skt.copy_frame_from_greenlet(gr, report=True)
+    assert report.frame_size is None
+    assert skt.deserialize_frame(skt.serialize_frame(copied), run=True) == 4
+    print("Test 'frame_report' passed")
+
+
+def test_frame_pool():
+    gr = greenlet.greenlet(resume_greenlet_fn)
+    gr.switch(10)
+    for limit in (0, 1 << 20):
+        previous = skt.set_frame_pool_limit(limit)
+        try:
+            for _ in range(20):
+                copied = skt.copy_frame_from_greenlet(gr)
+                restored = skt.deserialize_frame(skt.serialize_frame(copied))
+                assert skt.run_frame(restored) == 15
+                del copied, restored
+        finally:
+            assert skt.set_frame_pool_limit(previous) == limit
+    print("Test 'frame_pool' passed")
+
+
 def replace_locals_fn(c):
     a = 1
     b = 2
@@ -170,6 +815,16 @@ def test_replace_locals():
     print(f"The result is {res}")
     assert res == 144
 
+    # With run=True the frame is built on the data stack; a bad key must
+    # be rejected before anything is pushed there.
+    try:
+        skt.deserialize_frame(serframe, replace_locals={1000: 0}, run=True)
+    except IndexError:
+        pass
+    else:
+        assert False, "replace_locals index out of range was accepted"
+    assert skt.deserialize_frame(serframe, replace_locals={"b": 35}, run=True) == 49
+
     print("Test 'replace_locals' passed")
 
 
@@ -226,6 +881,31 @@ def test_exclude_locals_greenlet():
     print("Test 'exclude_locals_greenlet' passed")
 
 
+def test_compile_exclusions():
+    excluded = skt.compile_exclusions(exclude_locals_greenletfn, ["a"])
+    for c in (13, 14):
+        gr = greenlet.greenlet(exclude_locals_greenletfn)
+        gr.switch(c)
+        serframe = skt.copy_frame_from_greenlet(gr, serialize=True, exclude_locals=excluded)
+        result = skt.deserialize_frame(serframe, replace_locals={"a": 9}, run=True)
+        assert result == 11 + c
+
+    gr = greenlet.greenlet(replace_locals_fn)
+    gr.switch(13)
+    try:
+        skt.copy_frame_from_greenlet(gr, serialize=True, exclude_locals=excluded)
+        assert False, "exclusions compiled for another function must be rejected"
+    except ValueError:
+        pass
+
+    try:
+        type(excluded)()
+        assert False, "compiled exclusions must only come from compile_exclusions"
+    except TypeError:
+        pass
+    print("Test 'compile_exclusions' passed")
+
+
 def test_exclude_locals_current_frame():
     global calls
     calls = 0
@@ -255,6 +935,7 @@ def test_exclude_locals_current_frame():
 def test_exclude_locals():
     test_exclude_locals_greenlet()
     test_exclude_locals_current_frame()
+    test_compile_exclusions()
 
 
 def _copy_frame_and_switch():
@@ -466,6 +1147,87 @@ def test_capture_module_source_cross_file():
         print("Test 'capture_module_source_cross_file' passed")
 
 
+def test_code_registry_cross_process():
+    module_name = f"skt_registry_{uuid.uuid4().hex}"
+
+    with tempfile.TemporaryDirectory() as temp_dir:
+        registry_path = os.path.join(temp_dir, "registry")
+        frame_path = os.path.join(temp_dir, "frame.bin")
+        module_path = os.path.join(temp_dir, f"{module_name}.py")
+        producer_path = os.path.join(temp_dir, "producer.py")
+        consumer_path = os.path.join(temp_dir, "consumer.py")
+
+        module_source = textwrap.dedent(
+            """
+            import greenlet
+
+            def checkpoint(value):
+                token = "checkpointed"
+                greenlet.getcurrent().parent.switch()
+                return value + len(token)
+            """
+        )
+        with open(module_path, "w", encoding="utf-8") as f:
+            f.write(module_source)
+
+        producer_source = textwrap.dedent(
+            f"""
+            import importlib
+            import pathlib
+            import sys
+            import greenlet
+            import sauerkraut as skt
+
+            sys.path.insert(0, r"{temp_dir}")
+            skt.set_code_registry(skt.CodeRegistry(r"{registry_path}"))
+            module = importlib.import_module({module_name!r})
+            gr = greenlet.greenlet(module.checkpoint)
+            gr.switch(30)
+            full = skt.copy_frame_from_greenlet(gr, serialize=True)
+            frame_bytes = skt.copy_frame_from_greenlet(
+                gr, serialize=True, exclude_immutables=True
+            )
+            assert len(frame_bytes) < len(full)
+            pathlib.Path(r"{frame_path}").write_bytes(frame_bytes)
+            """
+        )
+        with open(producer_path, "w", encoding="utf-8") as f:
+            f.write(producer_source)
+
+        consumer_source = textwrap.dedent(
+            f"""
+            import pathlib
+            import sys
+            import sauerkraut as skt
+
+            sys.path.insert(0, r"{temp_dir}")
+            frame_bytes = pathlib.Path(r"{frame_path}").read_bytes()
+            try:
+                skt.deserialize_frame(frame_bytes)
+                assert False, "the code should be unknown without the registry"
+            except RuntimeError:
+                pass
+            skt.set_code_registry(skt.CodeRegistry(r"{registry_path}"))
+            result = skt.deserialize_frame(frame_bytes, run=True)
+            assert result == 42
+            """
+        )
+        with open(consumer_path, "w", encoding="utf-8") as f:
+            f.write(consumer_source)
+
+        for script in (producer_path, consumer_path):
+            proc = subprocess.run(
+                [sys.executable, script], env=dict(os.environ), capture_output=True, text=True
+            )
+            assert proc.returncode == 0, (
+                f"{os.path.basename(script)} failed\nstdout:\n"
+                + proc.stdout
+                + "\nstderr:\n"
+                + proc.stderr
+            )
+        print("Test 'code_registry_cross_process' passed")
+
+
 def test_liveness_basic():
     def sample_fn():
         a = 1
@@ -554,6 +1316,30 @@ test_copy_then_serialize()
 test_combined_copy_serialize()
 test_for_loop()
 test_greenlet()
+test_out_of_band_buffers()
+test_serialize_into_buffer()
+test_deserialize_from_buffers()
+test_native_values()
+test_shared_objects()
+test_compression()
+test_compression_native()
+test_delta_checkpoints()
+test_repeated_serialization()
+test_serialize_frames()
+test_same_name_immutables()
+test_immutables_outlive_function()
+test_dead_locals_liveness()
+test_stack_depth_with_block()
+test_selective_snapshot()
+test_background_snapshot()
+test_checkpoint_writer()
+test_aligned_checkpoint()
+test_checkpoint_archive()
+test_archive_recovery()
+test_peek_frame()
+test_stats()
+test_frame_report()
+test_frame_pool()
 test_replace_locals()
 test_exclude_locals()
 test_copy_frame()
@@ -561,4 +1347,5 @@ test_resume_greenlet()
 test_capture_module_source_default_reconstruct()
 test_capture_module_source_reconstruct_disabled()
 test_capture_module_source_cross_file()
+test_code_registry_cross_process()
 test_liveness()